@@ -0,0 +1,188 @@
+//
+//  BandProcessor.cpp
+//  Seminar
+//
+
+#include <algorithm>
+#include <vector>
+
+#include "oclw/Controller.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Kernel.h"
+#include "oclw/Exception.h"
+#include "oclw/Trace.h"
+
+#include "BandProcessor.h"
+
+namespace seminar {
+
+    BandProcessor::BandProcessor (oclw::Controller* controller, oclw::Kernel* cnv_kernel, oclw::Kernel* nms_kernel, size_t budget)
+        : _controller (controller), _cnv_kernel (cnv_kernel), _nms_kernel (nms_kernel) {
+        oclw::Controller::Info info = controller->getInfo();
+
+        _budget = budget ? budget : info.global_mem_size / 2;
+        _max_alloc_size = info.max_mem_alloc_size;
+
+        for (int i = 0; i < 2; i++) {
+            _in[i] = controller->createMemoryBuffer();
+            _out[i] = controller->createMemoryBuffer();
+        }
+
+        _weights = controller->createMemoryBuffer();
+    }
+
+    BandProcessor::~BandProcessor () {
+        for (int i = 0; i < 2; i++) {
+            _controller->release(_in[i]);
+            _controller->release(_out[i]);
+        }
+
+        _controller->release(_weights);
+    }
+
+    bool BandProcessor::needed (size_t image_size, size_t output_size) const {
+        return image_size + output_size > _budget || std::max(image_size, output_size) > _max_alloc_size;
+    }
+
+    size_t BandProcessor::rowsInBudget (size_t bytes_per_row, size_t fixed_bytes) const {
+        /* Two slots (double buffering), each with input and output buffer */
+        size_t slot_budget = _budget / 2;
+
+        if (slot_budget <= fixed_bytes)
+            throw oclw::Exception("Memory budget too small for a single band.");
+
+        size_t rows = (slot_budget - fixed_bytes) / bytes_per_row;
+        return std::min(rows, _max_alloc_size / bytes_per_row);
+    }
+
+    void BandProcessor::reserve (int slot, size_t in_size, size_t out_size) {
+        _in[slot]->reserve(oclw::MemoryBuffer::READ, in_size);
+        _out[slot]->reserve(oclw::MemoryBuffer::READ_WRITE, out_size);
+    }
+
+    /* Waits for bands still in flight and releases their events. Also called when
+     * enqueueing fails, as pending readbacks write to host memory of the caller.
+     */
+    static void finishBands (oclw::Controller* controller, cl_event done[2]) {
+        controller->finish();
+
+        for (int i = 0; i < 2; i++)
+            if (done[i] != NULL) {
+                clReleaseEvent(done[i]);
+                done[i] = NULL;
+            }
+    }
+
+    void BandProcessor::convolve2d (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height, int kernel_size) {
+        /* Band of R output rows reads R + kernel_size - 1 input rows */
+        size_t halo = kernel_size - 1;
+        size_t band_rows = rowsInBudget(in_width + width, halo * in_width + kernel_size * kernel_size);
+
+        if (band_rows == 0)
+            throw oclw::Exception("Memory budget too small for a single band.");
+
+        band_rows = std::min(band_rows, (size_t)height);
+        reserve(0, (band_rows + halo) * in_width, band_rows * width);
+        reserve(1, (band_rows + halo) * in_width, band_rows * width);
+
+        _weights->reserve(oclw::MemoryBuffer::READ, kernel_size * kernel_size);
+        _weights->writeData((void*)kernel, kernel_size * kernel_size);
+
+        cl_event done[2] = { NULL, NULL };
+
+        try {
+            for (size_t row = 0, band = 0; row < (size_t)height; row += band_rows, band++) {
+                int slot = band % 2;
+                int rows = std::min(band_rows, height - row);
+
+                /* Slot is free once readback of band before last is completed */
+                if (done[slot] != NULL) {
+                    oclw::TraceSpan span ("wait for band", "app");
+                    clWaitForEvents(1, &done[slot]);
+                    clReleaseEvent(done[slot]);
+                    done[slot] = NULL;
+                }
+
+                _in[slot]->writeDataAsync(in + row * in_width, (rows + halo) * in_width);
+
+                _cnv_kernel->launch(oclw::Kernel::NDRange::range2D(width, rows),
+                                    *_in[slot], *_out[slot], *_weights, in_width, width, rows, kernel_size);
+
+                _out[slot]->readDataAsync(out + row * width, rows * width, &done[slot]);
+                _controller->flush();
+            }
+        } catch (...) {
+            finishBands(_controller, done);
+            throw;
+        }
+
+        finishBands(_controller, done);
+    }
+
+    void BandProcessor::nms (const uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n) {
+        /* Blocks are (n+1)x(n+1) and start at n + k*(n+1). Band of B block rows starting at
+         * block row v0 needs image rows [v0*(n+1), v0*(n+1) + B*(n+1) + 2n], as maximum search
+         * reaches n rows beyond its block. Band results are merged into maxima with OR, so
+         * maxima found by neighbouring bands are never overwritten. Loop goes on until both
+         * slots are merged, as the last band may be in either of them.
+         */
+        unsigned int blocks_x = (W - 2*n)/(n+1) + 1;
+        unsigned int blocks_y = (H - 2*n)/(n+1) + 1;
+
+        size_t block_rows = rowsInBudget(2 * W * (n + 1), 2 * W * (2*n + 1));
+
+        if (block_rows == 0)
+            throw oclw::Exception("Memory budget too small for a single band.");
+
+        block_rows = std::min(block_rows, (size_t)blocks_y);
+        size_t band_size = (block_rows * (n + 1) + 2*n + 1) * W;
+        reserve(0, band_size, band_size);
+        reserve(1, band_size, band_size);
+
+        std::vector<uint8_t> results[2] = { std::vector<uint8_t>(band_size), std::vector<uint8_t>(band_size) };
+
+        cl_event done[2] = { NULL, NULL };
+        size_t done_first_row[2];
+        unsigned int done_rows[2];
+
+        /* Readbacks in flight write to results, which goes away if an exception propagates */
+        try {
+            for (size_t v0 = 0, band = 0; v0 < blocks_y || done[0] != NULL || done[1] != NULL; v0 += block_rows, band++) {
+                int slot = band % 2;
+
+                /* Merge results of the band that used this slot before */
+                if (done[slot] != NULL) {
+                    oclw::TraceSpan span ("wait for band", "app");
+                    clWaitForEvents(1, &done[slot]);
+                    clReleaseEvent(done[slot]);
+                    done[slot] = NULL;
+
+                    uint8_t* dst = maxima + done_first_row[slot] * W;
+                    for (size_t i = 0; i < done_rows[slot] * W; i++)
+                        dst[i] |= results[slot][i];
+                }
+
+                if (v0 >= blocks_y)
+                    continue;
+
+                unsigned int blocks = std::min(block_rows, blocks_y - v0);
+                size_t first_row = v0 * (n + 1);
+                unsigned int rows = std::min((size_t)H, first_row + blocks * (n + 1) + 2*n + 1) - first_row;
+
+                _in[slot]->writeDataAsync(image + first_row * W, rows * W);
+                /* Kernel only marks maxima, band output is cleared on the device first */
+                _out[slot]->fill(0, 0, rows * W);
+
+                _nms_kernel->launch(oclw::Kernel::NDRange::range2D(blocks_x, blocks), *_in[slot], *_out[slot], W, rows, n);
+
+                _out[slot]->readDataAsync(&results[slot][0], rows * W, &done[slot]);
+                done_first_row[slot] = first_row;
+                done_rows[slot] = rows;
+                _controller->flush();
+            }
+        } catch (...) {
+            finishBands(_controller, done);
+            throw;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+//
+//  BandProcessor.h
+//  Seminar
+//
+
+#ifndef Seminar_BandProcessor_h
+#define Seminar_BandProcessor_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace oclw {
+    class Controller;
+    class Kernel;
+    class MemoryBuffer;
+}
+
+namespace seminar {
+
+    /*! Runs convolve2d and nms kernels on images that do not fit into device memory.
+     *
+     *  Image is processed in horizontal bands. Each band carries the rows of its
+     *  neighbours that the kernel reads (halo), so results are identical to
+     *  processing whole image at once. Two sets of band buffers are used in turn:
+     *  while host waits for the readback of one band, the next one is already
+     *  being uploaded and processed. Convolution results are read back directly
+     *  to their place in the output image; NMS results are merged (OR) into the
+     *  output while the device works on the next band.
+     *
+     *  Band height is derived from the memory budget, so device memory use is
+     *  fixed regardless of image size.
+     */
+    class BandProcessor {
+    private:
+        oclw::Controller* _controller;
+        oclw::Kernel* _cnv_kernel;
+        oclw::Kernel* _nms_kernel;
+
+        size_t _budget;
+        size_t _max_alloc_size;
+
+        oclw::MemoryBuffer* _in[2];
+        oclw::MemoryBuffer* _out[2];
+        oclw::MemoryBuffer* _weights;
+
+        BandProcessor (const BandProcessor&);
+        BandProcessor& operator= (const BandProcessor&);
+
+        /* Returns number of band rows whose buffers fit into budget */
+        size_t rowsInBudget (size_t bytes_per_row, size_t fixed_bytes) const;
+
+        /* Makes sure slot buffers are at least this big */
+        void reserve (int slot, size_t in_size, size_t out_size);
+
+    public:
+        /*! \param cnv_kernel convolve2d kernel object.
+         *  \param nms_kernel nms kernel object.
+         *  \param budget Device memory (in bytes) band buffers may use. If 0, half of device
+         *  global memory is used.
+         */
+        BandProcessor (oclw::Controller* controller, oclw::Kernel* cnv_kernel, oclw::Kernel* nms_kernel, size_t budget = 0);
+
+        /*! Releases band buffers.
+         */
+        ~BandProcessor ();
+
+        /*! Returns true if image of given size can not be processed as a whole.
+         *
+         *  \param image_size Size of the input image in bytes.
+         *  \param output_size Size of the output image in bytes.
+         */
+        bool needed (size_t image_size, size_t output_size) const;
+
+        /*! Same as seminar::convolution2d, but performed on the OpenCL device.
+         */
+        void convolve2d (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height, int kernel_size);
+
+        /*! Same as seminar::nsm, but performed on the OpenCL device.
+         */
+        void nms (const uint8_t* image, unsigned int width, unsigned int height, uint8_t* maxima, unsigned int nms_n);
+    };
+}
+
+#endif
@@ -0,0 +1,83 @@
+//
+//  BoundedQueue.h
+//  Seminar
+//
+
+#ifndef Seminar_BoundedQueue_h
+#define Seminar_BoundedQueue_h
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace seminar {
+
+    /*! Blocking FIFO queue with limited capacity.
+     *
+     *  push() blocks while queue is full so a fast producer can not run
+     *  ahead of a slow consumer (back-pressure). After close() is called,
+     *  consumers drain the remaining items and then pop() returns false.
+     */
+    template <typename T>
+    class BoundedQueue {
+    private:
+        std::deque<T> _items;
+        size_t _capacity;
+        bool _closed;
+
+        std::mutex _mutex;
+        std::condition_variable _not_empty;
+        std::condition_variable _not_full;
+
+    public:
+        BoundedQueue (size_t capacity) : _capacity (capacity), _closed (false) {}
+
+        /*! Appends item to the queue. Blocks while queue is full.
+         *
+         *  \return false if queue was closed and item was not added.
+         */
+        bool push (const T& item) {
+            std::unique_lock<std::mutex> lock (_mutex);
+
+            while (_items.size() >= _capacity && !_closed)
+                _not_full.wait(lock);
+
+            if (_closed)
+                return false;
+
+            _items.push_back(item);
+            _not_empty.notify_one();
+            return true;
+        }
+
+        /*! Removes item from the front of the queue. Blocks while queue is empty.
+         *
+         *  \return false if queue is closed and there are no more items.
+         */
+        bool pop (T& item) {
+            std::unique_lock<std::mutex> lock (_mutex);
+
+            while (_items.empty() && !_closed)
+                _not_empty.wait(lock);
+
+            if (_items.empty())
+                return false;
+
+            item = _items.front();
+            _items.pop_front();
+            _not_full.notify_one();
+            return true;
+        }
+
+        /*! Marks queue as closed. Wakes up all waiting producers and consumers.
+         */
+        void close () {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _closed = true;
+            _not_empty.notify_all();
+            _not_full.notify_all();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,108 @@
+//
+//  ChannelProcessor.cpp
+//  Seminar
+//
+
+#include "oclw/Exception.h"
+
+#include "ChannelProcessor.h"
+
+namespace seminar {
+
+    ChannelProcessor::ChannelProcessor (oclw::Controller* controller, oclw::Program* program)
+        : _controller (controller),
+          _deinterleave8 (program->createKernel("deinterleave8")),
+          _deinterleave16 (program->createKernel("deinterleave16")),
+          _interleave8 (program->createKernel("interleave8")),
+          _interleave16 (program->createKernel("interleave16")),
+          _convolve2d (program->createKernel("convolve2d_planar")),
+          _nms (program->createKernel("nms_planar")),
+          _interleaved (controller->createMemoryBuffer()),
+          _planes (controller->createMemoryBuffer()),
+          _result (controller->createMemoryBuffer()),
+          _weights (controller->createMemoryBuffer()),
+          _width (0), _height (0), _plane_count (0), _sample_size (1) {}
+
+    void ChannelProcessor::upload (const void* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int sample_size) {
+        if (channels < 1 || channels > 4 || (sample_size != 1 && sample_size != 2))
+            throw oclw::Exception("Unsupported pixel format.");
+
+        _width = width;
+        _height = height;
+        _sample_size = sample_size;
+
+        /* Gray + alpha keeps gray, RGBA keeps RGB */
+        _plane_count = (channels == 2 || channels == 4) ? channels - 1 : channels;
+
+        size_t pixels_size = (size_t)width * height * channels * sample_size;
+        _interleaved->reserve(oclw::MemoryBuffer::READ_WRITE, pixels_size);
+        _planes->reserve(oclw::MemoryBuffer::READ_WRITE, (size_t)width * height * _plane_count * sizeof(uint16_t));
+
+        _interleaved->writeDataAsync(pixels, pixels_size);
+
+        oclw::Kernel* kernel = sample_size == 1 ? _deinterleave8.get() : _deinterleave16.get();
+        kernel->launch(oclw::Kernel::NDRange::range2D(width, height), *_interleaved, *_planes,
+                       (int)width, (int)height, (int)channels, (int)_plane_count);
+    }
+
+    unsigned int ChannelProcessor::planes () const {
+        return _plane_count;
+    }
+
+    void ChannelProcessor::readResult (unsigned int width, unsigned int height, void* out) {
+        size_t out_size = (size_t)width * height * _plane_count * _sample_size;
+
+        /* Interleaved input is no longer needed, its buffer takes the joined result */
+        _interleaved->reserve(oclw::MemoryBuffer::READ_WRITE, out_size);
+
+        oclw::Kernel* kernel = _sample_size == 1 ? _interleave8.get() : _interleave16.get();
+        kernel->launch(oclw::Kernel::NDRange::range2D(width, height), *_result, *_interleaved,
+                       (int)width, (int)height, (int)_plane_count);
+
+        _interleaved->readData(out, out_size);
+    }
+
+    void ChannelProcessor::convolve2d (const int8_t* kernel, int kernel_size, void* out) {
+        if (_plane_count == 0)
+            throw oclw::Exception("No image uploaded.");
+
+        /* 32-bit sum of up to 256 products of 16-bit samples and 8-bit weights */
+        if (_sample_size == 2 && kernel_size > 16)
+            throw oclw::Exception("Kernels larger than 16x16 would overflow sums of 16-bit samples.");
+
+        if (kernel_size < 1 || _width < (unsigned int)kernel_size || _height < (unsigned int)kernel_size)
+            throw oclw::Exception("Image is smaller than convolution kernel.");
+
+        unsigned int out_width = _width - kernel_size + 1;
+        unsigned int out_height = _height - kernel_size + 1;
+
+        _weights->reserve(oclw::MemoryBuffer::READ, kernel_size * kernel_size);
+        _result->reserve(oclw::MemoryBuffer::READ_WRITE, (size_t)out_width * out_height * _plane_count * sizeof(uint16_t));
+
+        _weights->writeDataAsync(kernel, kernel_size * kernel_size);
+
+        int max_value = _sample_size == 1 ? 0xFF : 0xFFFF;
+        _convolve2d->launch(oclw::Kernel::NDRange::range3D(out_width, out_height, _plane_count), *_planes, *_result, *_weights,
+                            (int)_width, (int)_height, (int)out_width, (int)out_height, kernel_size, max_value);
+
+        readResult(out_width, out_height, out);
+    }
+
+    void ChannelProcessor::nms (unsigned int nms_n, void* maxima) {
+        if (_plane_count == 0)
+            throw oclw::Exception("No image uploaded.");
+
+        if (_width <= 2 * nms_n || _height <= 2 * nms_n)
+            throw oclw::Exception("Image is smaller than NMS neighbourhood.");
+
+        size_t planes_size = (size_t)_width * _height * _plane_count * sizeof(uint16_t);
+        _result->reserve(oclw::MemoryBuffer::READ_WRITE, planes_size);
+        _result->fill(0, 0, planes_size);
+
+        int mark = _sample_size == 1 ? 0xFF : 0xFFFF;
+        _nms->launch(oclw::Kernel::NDRange::range3D((_width - 2*nms_n)/(nms_n+1)+1, (_height - 2*nms_n)/(nms_n+1)+1, _plane_count),
+                     *_planes, *_result, _width, _height, (int)nms_n, mark);
+
+        readResult(_width, _height, maxima);
+    }
+}
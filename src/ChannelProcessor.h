@@ -0,0 +1,109 @@
+//
+//  ChannelProcessor.h
+//  Seminar
+//
+
+#ifndef Seminar_ChannelProcessor_h
+#define Seminar_ChannelProcessor_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "oclw/Controller.h"
+#include "oclw/Program.h"
+#include "oclw/Kernel.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Handle.h"
+
+namespace seminar {
+
+    /*! Runs convolve2d and nms on every channel of a color or 16-bit image.
+     *
+     *  Image is uploaded as decoded (interleaved, 8 or 16 bits per sample) and
+     *  split into planes of 16-bit samples on the device, so the host does not
+     *  touch pixels. Alpha channel is dropped. Each operation processes all
+     *  planes in one launch (the third dimension of the range selects the
+     *  plane) and results are joined back into interleaved pixels of the input
+     *  sample size on the device:
+     *
+     *  \code
+     *  seminar::PngReader png (path, false);
+     *  std::vector<uint8_t> pixels (png.width() * png.height() * png.channels() * png.sampleSize());
+     *  png.read(&pixels[0], png.width() * png.channels() * png.sampleSize(), png.height());
+     *
+     *  seminar::ChannelProcessor processor (controller, program);
+     *  processor.upload(&pixels[0], png.width(), png.height(), png.channels(), png.sampleSize());
+     *  processor.convolve2d(kernel, kernel_size, &result[0]);
+     *  \endcode
+     *
+     *  Convolution sums are 32-bit and saturate to the sample range, so
+     *  results differ from the 8-bit gray convolve2d kernel, which wraps around.
+     */
+    class ChannelProcessor {
+    private:
+        oclw::Controller* _controller;
+
+        oclw::Handle<oclw::Kernel> _deinterleave8;
+        oclw::Handle<oclw::Kernel> _deinterleave16;
+        oclw::Handle<oclw::Kernel> _interleave8;
+        oclw::Handle<oclw::Kernel> _interleave16;
+        oclw::Handle<oclw::Kernel> _convolve2d;
+        oclw::Handle<oclw::Kernel> _nms;
+
+        oclw::Handle<oclw::MemoryBuffer> _interleaved;
+        oclw::Handle<oclw::MemoryBuffer> _planes;
+        oclw::Handle<oclw::MemoryBuffer> _result;
+        oclw::Handle<oclw::MemoryBuffer> _weights;
+
+        unsigned int _width, _height;
+        unsigned int _plane_count;
+        unsigned int _sample_size;
+
+        ChannelProcessor (const ChannelProcessor&);
+        ChannelProcessor& operator= (const ChannelProcessor&);
+
+        /* Joins width x height planes of _result into out */
+        void readResult (unsigned int width, unsigned int height, void* out);
+
+    public:
+        /*! \param program Program built from cl_program.cl. Processor creates its own kernels.
+         */
+        ChannelProcessor (oclw::Controller* controller, oclw::Program* program);
+
+        /*! Starts uploading interleaved image and splitting it into planes. Pixels must
+         *  stay valid until the next convolve2d() or nms() returns.
+         *
+         *  \param channels Samples per pixel: 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA).
+         *  \param sample_size 1 or 2 bytes.
+         */
+        void upload (const void* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int sample_size);
+
+        /*! Returns number of channels processed (and written to results), that is
+         *  uploaded channels without alpha.
+         */
+        unsigned int planes () const;
+
+        /*! Valid convolution of every channel with the same signed kernel. Blocks until
+         *  result is read.
+         *
+         *  \param out Interleaved (width - kernel_size + 1) x (height - kernel_size + 1)
+         *  pixels of planes() samples of the uploaded sample size.
+         *
+         *  Throws oclw::Exception if image is smaller than the kernel, or for 16-bit
+         *  images and kernels larger than 16x16.
+         */
+        void convolve2d (const int8_t* kernel, int kernel_size, void* out);
+
+        /*! Same as seminar::nsm, for every channel. Maxima are set to the largest
+         *  sample value, other samples to 0. Blocks until result is read.
+         *
+         *  \param maxima Interleaved width x height pixels of planes() samples of the
+         *  uploaded sample size.
+         *
+         *  Throws oclw::Exception if image is not larger than 2 * nms_n in both directions.
+         */
+        void nms (unsigned int nms_n, void* maxima);
+    };
+}
+
+#endif
@@ -0,0 +1,40 @@
+//
+//  Clock.h
+//  Seminar
+//
+//  Created by Srđan Rašić on 4/02/12.
+//
+
+#ifndef Seminar_Clock_h
+#define Seminar_Clock_h
+
+#include <time.h>
+
+/*! Simple timer class. Use tick() and tock() 
+ *  methods to measure time.
+ */
+class Clock {
+private:
+    timespec _start_time;
+    
+public:
+    /*! Starts clock.
+     */
+    void tick() {
+        clock_gettime(CLOCK_MONOTONIC, &_start_time);
+    }
+    
+    /*! Gets elapsed time since start or since last call of itself.
+     *  \param ret Elapsed time since last call to tick() in milliseconds.
+     */
+    void tock(double& ret) {
+        timespec end_time;
+        
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        ret = (end_time.tv_sec - _start_time.tv_sec) * 1000.0 + (end_time.tv_nsec - _start_time.tv_nsec) / 1000000.0;
+        
+        _start_time = end_time;
+    }
+};
+
+#endif
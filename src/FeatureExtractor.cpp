@@ -0,0 +1,78 @@
+//
+//  FeatureExtractor.cpp
+//  Seminar
+//
+
+#include <algorithm>
+
+#include "FeatureExtractor.h"
+
+namespace seminar {
+
+    static bool keypointOrder (const Keypoint& a, const Keypoint& b) {
+        if (a.y != b.y)
+            return a.y < b.y;
+        if (a.x != b.x)
+            return a.x < b.x;
+        return a.type < b.type;
+    }
+
+    FeatureExtractor::FeatureExtractor (oclw::Controller* controller, oclw::Program* program, unsigned int capacity, float k)
+        : _controller (controller),
+          _smooth (program->createKernel("smooth3x3")),
+          _sobel (program->createKernel("sobel3x3")),
+          _harris (program->createKernel("harris")),
+          _nms (program->createKernel("nms_minmax")),
+          _smoothed (controller->createMemoryBuffer()),
+          _gx (controller->createMemoryBuffer()),
+          _gy (controller->createMemoryBuffer()),
+          _response (controller->createMemoryBuffer()),
+          _keypoints (controller->createMemoryBuffer(oclw::MemoryBuffer::WRITE, capacity * sizeof(Keypoint))),
+          _count (controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, sizeof(cl_uint))),
+          _capacity (capacity), _k (k) {}
+
+    size_t FeatureExtractor::extract (oclw::MemoryBuffer& image, unsigned int width, unsigned int height, unsigned int nms_n,
+                                      float threshold, std::vector<Keypoint>& keypoints, bool smooth) {
+        keypoints.clear();
+
+        /* Sobel and the tensor window read 2 pixels around each point */
+        unsigned int margin = nms_n + 2;
+
+        if (width <= 2 * margin || height <= 2 * margin)
+            return 0;
+
+        size_t pixels = (size_t)width * height;
+        oclw::Kernel::NDRange range = oclw::Kernel::NDRange::range2D(width, height);
+
+        _gx->reserve(oclw::MemoryBuffer::READ_WRITE, pixels * sizeof(cl_short));
+        _gy->reserve(oclw::MemoryBuffer::READ_WRITE, pixels * sizeof(cl_short));
+        _response->reserve(oclw::MemoryBuffer::READ_WRITE, pixels * sizeof(cl_float));
+
+        oclw::MemoryBuffer* input = &image;
+
+        if (smooth) {
+            _smoothed->reserve(oclw::MemoryBuffer::READ_WRITE, pixels);
+            _smooth->launch(range, image, *_smoothed, (int)width, (int)height);
+            input = _smoothed.get();
+        }
+
+        _sobel->launch(range, *input, *_gx, *_gy, (int)width, (int)height);
+        _harris->launch(range, *_gx, *_gy, *_response, (int)width, (int)height, _k);
+
+        _count->fill(0);
+        _nms->launch(oclw::Kernel::NDRange::range2D((width - 2 * margin + nms_n) / (nms_n + 1), (height - 2 * margin + nms_n) / (nms_n + 1)),
+                     *_response, *_keypoints, *_count, _capacity, (int)width, (int)height, (int)nms_n, (int)margin, threshold);
+
+        /* Only the count and the list come back */
+        cl_uint found = 0;
+        _count->readData(&found, sizeof(found));
+
+        keypoints.resize(std::min((unsigned int)found, _capacity));
+        if (!keypoints.empty())
+            _keypoints->readData(&keypoints[0], keypoints.size() * sizeof(Keypoint));
+
+        /* Work items append in no particular order */
+        std::sort(keypoints.begin(), keypoints.end(), keypointOrder);
+        return found;
+    }
+}
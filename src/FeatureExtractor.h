@@ -0,0 +1,90 @@
+//
+//  FeatureExtractor.h
+//  Seminar
+//
+
+#ifndef Seminar_FeatureExtractor_h
+#define Seminar_FeatureExtractor_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "oclw/Controller.h"
+#include "oclw/Program.h"
+#include "oclw/Kernel.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Handle.h"
+
+namespace seminar {
+
+    /*! Feature point, same layout as keypoint_t in cl_program.cl.
+     */
+    struct Keypoint {
+        int32_t x;
+        int32_t y;
+        int32_t type;       /*!< 1 for maximum, -1 for minimum of the response. */
+        float score;        /*!< Harris response at the point. */
+    };
+
+    /*! Finds Harris corners (maxima) and their negative counterparts (minima)
+     *  of an 8-bit gray image on the OpenCL device.
+     *
+     *  Pipeline is the front end of libviso2: optional 3x3 binomial smoothing
+     *  (smooth3x3 kernel), Sobel gradients, Harris response of the structure
+     *  tensor and NMS that finds maxima and minima at once. Keypoints are
+     *  compacted into a list on the device, so only their count and the list
+     *  are read back:
+     *
+     *  \code
+     *  seminar::FeatureExtractor extractor (controller, program);
+     *  std::vector<seminar::Keypoint> keypoints;
+     *  extractor.extract(*image_gpu, width, height, 3, 1e5f, keypoints);
+     *  \endcode
+     */
+    class FeatureExtractor {
+    private:
+        oclw::Controller* _controller;
+
+        oclw::Handle<oclw::Kernel> _smooth;
+        oclw::Handle<oclw::Kernel> _sobel;
+        oclw::Handle<oclw::Kernel> _harris;
+        oclw::Handle<oclw::Kernel> _nms;
+
+        oclw::Handle<oclw::MemoryBuffer> _smoothed;
+        oclw::Handle<oclw::MemoryBuffer> _gx;
+        oclw::Handle<oclw::MemoryBuffer> _gy;
+        oclw::Handle<oclw::MemoryBuffer> _response;
+        oclw::Handle<oclw::MemoryBuffer> _keypoints;
+        oclw::Handle<oclw::MemoryBuffer> _count;
+
+        unsigned int _capacity;
+        float _k;
+
+        FeatureExtractor (const FeatureExtractor&);
+        FeatureExtractor& operator= (const FeatureExtractor&);
+
+    public:
+        /*! \param program Program built from cl_program.cl. Extractor creates its own kernels.
+         *  \param capacity Maximum number of keypoints returned by one extract().
+         *  \param k Harris sensitivity, usually 0.04 - 0.06.
+         */
+        FeatureExtractor (oclw::Controller* controller, oclw::Program* program, unsigned int capacity = 16384, float k = 0.04f);
+
+        /*! Finds keypoints of the image and blocks until they are read.
+         *
+         *  Image border of nms_n + 2 pixels is skipped. Keypoints are sorted by
+         *  row, column and type.
+         *
+         *  \param image 8-bit gray width x height image on the device.
+         *  \param threshold Maxima must have response above threshold, minima below -threshold.
+         *  \param keypoints Receives at most capacity keypoints.
+         *  \param smooth If true, image is smoothed with 3x3 binomial filter first.
+         *  \return Number of keypoints found, larger than keypoints.size() if capacity was exceeded.
+         */
+        size_t extract (oclw::MemoryBuffer& image, unsigned int width, unsigned int height, unsigned int nms_n,
+                        float threshold, std::vector<Keypoint>& keypoints, bool smooth = true);
+    };
+}
+
+#endif
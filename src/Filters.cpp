@@ -6,10 +6,17 @@
 //
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include "Filters.h"
+#include "WorkerPool.h"
 
 #include <omp.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace seminar {
     
    
@@ -21,19 +28,18 @@ namespace seminar {
         return (a > b) ? a : b;
     }
     
-    void nsm (uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n) {
-        unsigned int i = n, j = n;
-        
-        #pragma omp parallel for
-        for (unsigned int u = 0; u <= (W - 2*n)/(n+1); u++) {
+    /* NMS of columns of blocks [u0, u1) */
+    static void nsmBlocks (const uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n,
+                           unsigned int u0, unsigned int u1) {
+        for (unsigned int u = u0; u < u1; u++) {
             for (unsigned int v = 0; v <= (H - 2*n)/(n+1); v++) {
-                i = n + u * (n + 1);
-                j = n + v * (n + 1);
+                const unsigned int i = n + u * (n + 1);
+                const unsigned int j = n + v * (n + 1);
                 
                 unsigned int mi = i, mj = j;
                 
-                for (unsigned int i2 = i; i2 <= i + n; i2++)
-                    for (unsigned int j2 = j; j2 <= j + n; j2++)
+                for (unsigned int i2 = i; i2 <= min (i + n, W - 1); i2++)
+                    for (unsigned int j2 = j; j2 <= min (j + n, H - 1); j2++)
                         if (image[j2*W + i2] > image[mj*W + mi]) {
                             mi = i2;
                             mj = j2;
@@ -49,12 +55,111 @@ namespace seminar {
             }
         }
     }
+    
+    void nsm (uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n) {
+        const int columns = (W - 2*n)/(n+1) + 1;
         
-    void convolution2d (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height, int kernel_size) {
-        int threads = omp_get_max_threads();
-
-#pragma omp parallel for num_threads(threads)
-        for (int y = 0; y < height; y++) {
+        #pragma omp parallel for
+        for (int u = 0; u < columns; u++)
+            nsmBlocks(image, W, H, maxima, n, u, u + 1);
+    }
+    
+    void nsm (WorkerPool& pool, const uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n) {
+        const int columns = (W - 2*n)/(n+1) + 1;
+        
+        pool.parallelFor(columns, pool.grain(columns), [&] (int begin, int end) {
+            nsmBlocks(image, W, H, maxima, n, begin, end);
+        });
+    }
+        
+    /* Running max of window 2n+1 centered at each of count positions read with stride, for
+     * lanes neighbouring values at each position. Values outside of [0, count) count as 0.
+     * g and h hold (count + 4n + 2) * lanes values.
+     *
+     * Window [x - n, x + n] becomes [x, x + 2n] in coordinates padded by n; it spans two
+     * segments of length 2n+1 (or is one), so its max is the suffix max of the first
+     * and the prefix max of the second.
+     */
+    static void runningMax (const uint8_t* in, uint8_t* out, int count, int stride, int lanes, int n, uint8_t* g, uint8_t* h) {
+        const int window = 2 * n + 1;
+        const int padded = (count + 2 * n + window - 1) / window * window;
+        
+        for (int p = 0; p < padded; p++) {
+            const bool inside = p >= n && p - n < count;
+            const uint8_t* src = in + (p - n) * stride;
+            uint8_t* dst = g + p * lanes;
+            
+            for (int l = 0; l < lanes; l++) {
+                const uint8_t value = inside ? src[l] : 0;
+                dst[l] = (p % window == 0 || value > dst[l - lanes]) ? value : dst[l - lanes];
+            }
+        }
+        
+        for (int p = padded - 1; p >= 0; p--) {
+            const bool inside = p >= n && p - n < count;
+            const uint8_t* src = in + (p - n) * stride;
+            uint8_t* dst = h + p * lanes;
+            
+            for (int l = 0; l < lanes; l++) {
+                const uint8_t value = inside ? src[l] : 0;
+                dst[l] = ((p + 1) % window == 0 || value > dst[l + lanes]) ? value : dst[l + lanes];
+            }
+        }
+        
+        for (int x = 0; x < count; x++)
+            for (int l = 0; l < lanes; l++) {
+                const uint8_t suffix = h[x * lanes + l], prefix = g[(x + 2 * n) * lanes + l];
+                out[x * stride + l] = suffix > prefix ? suffix : prefix;
+            }
+    }
+    
+    void nsmRunningMax (const uint8_t* image, unsigned int W, unsigned int H, uint8_t* maxima, unsigned int n) {
+        std::vector<uint8_t> rows (W * H), dilated (W * H);
+        
+        /* Vertical pass handles strips of columns, so it reads whole cache lines */
+        const int strip = 64;
+        const int scratch = (std::max(W, H) + 4 * n + 2) * strip;
+        
+        /* Horizontal, then vertical pass of separable dilation */
+#pragma omp parallel
+        {
+            std::vector<uint8_t> g (scratch), h (scratch);
+            
+#pragma omp for
+            for (int y = 0; y < (int)H; y++)
+                runningMax(image + y * W, &rows[y * W], W, 1, 1, n, &g[0], &h[0]);
+            
+#pragma omp for
+            for (int x = 0; x < (int)W; x += strip)
+                runningMax(&rows[x], &dilated[x], H, W, std::min(strip, (int)W - x), n, &g[0], &h[0]);
+        }
+        
+        /* Maximum of each block (first one found, as in nsm) is kept if nothing around is larger */
+#pragma omp parallel for
+        for (int u = 0; u <= (int)((W - 2*n)/(n+1)); u++) {
+            for (unsigned int v = 0; v <= (H - 2*n)/(n+1); v++) {
+                const unsigned int i = n + u * (n + 1);
+                const unsigned int j = n + v * (n + 1);
+                
+                unsigned int mi = i, mj = j;
+                
+                for (unsigned int i2 = i; i2 <= min(i + n, W - 1); i2++)
+                    for (unsigned int j2 = j; j2 <= min(j + n, H - 1); j2++)
+                        if (image[j2*W + i2] > image[mj*W + mi]) {
+                            mi = i2;
+                            mj = j2;
+                        }
+                
+                if (image[mj*W + mi] == dilated[mj*W + mi])
+                    maxima[mj*W + mi] = 255;
+            }
+        }
+    }
+        
+    /* Convolution of output rows [y0, y1) */
+    static void convolveRows (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width,
+                              int kernel_size, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
             const int y_top_left = y;
             
             for (int x = 0; x < width; x++) {
@@ -77,4 +182,233 @@ namespace seminar {
             }
         }
     }
+    
+    void convolution2d (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height, int kernel_size) {
+        int threads = omp_get_max_threads();
+
+#pragma omp parallel for num_threads(threads)
+        for (int y = 0; y < height; y++)
+            convolveRows(in, out, kernel, in_width, width, kernel_size, y, y + 1);
+    }
+    
+    /* Same as convolveRows, 16 pixels at a time. Products are summed in 16-bit lanes,
+     * whose low byte equals the 8-bit sum, so results are identical.
+     */
+    static void convolveRowsSimd (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width,
+                                  int kernel_size, int y0, int y1) {
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low_byte = _mm_set1_epi16(0xff);
+        
+        for (int y = y0; y < y1; y++) {
+            int x = 0;
+            
+            for (; x + 16 <= width; x += 16) {
+                __m128i sum_lo = zero, sum_hi = zero;
+                
+                for (int yy = 0; yy < kernel_size; yy++) {
+                    const uint8_t* row = in + (y + yy) * in_width + x;
+                    
+                    for (int xx = 0; xx < kernel_size; xx++) {
+                        const __m128i weight = _mm_set1_epi16(kernel[yy * kernel_size + xx]);
+                        const __m128i pixels = _mm_loadu_si128((const __m128i*)(row + xx));
+                        
+                        sum_lo = _mm_add_epi16(sum_lo, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weight));
+                        sum_hi = _mm_add_epi16(sum_hi, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weight));
+                    }
+                }
+                
+                _mm_storeu_si128((__m128i*)(out + y * width + x),
+                                 _mm_packus_epi16(_mm_and_si128(sum_lo, low_byte), _mm_and_si128(sum_hi, low_byte)));
+            }
+            
+            for (; x < width; x++) {
+                uint8_t sum = 0;
+                for (int yy = 0; yy < kernel_size; yy++)
+                    for (int xx = 0; xx < kernel_size; xx++)
+                        sum += kernel[yy * kernel_size + xx] * in[(y + yy) * in_width + x + xx];
+                
+                out[y * width + x] = sum;
+            }
+        }
+#else
+        convolveRows(in, out, kernel, in_width, width, kernel_size, y0, y1);
+#endif
+    }
+    
+    void convolution2dSimd (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height,
+                            int kernel_size) {
+#pragma omp parallel for
+        for (int y = 0; y < height; y++)
+            convolveRowsSimd(in, out, kernel, in_width, width, kernel_size, y, y + 1);
+    }
+    
+    void convolution2d (WorkerPool& pool, const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height,
+                        int kernel_size) {
+        pool.parallelFor(height, pool.grain(height), [&] (int begin, int end) {
+            convolveRows(in, out, kernel, in_width, width, kernel_size, begin, end);
+        });
+    }
+    
+    void smooth3x3 (const uint8_t* in, uint8_t* out, int width, int height) {
+#pragma omp parallel for
+        for (int y = 0; y < height; y++) {
+            const uint8_t* above = in + (y > 0 ? y - 1 : 0) * width;
+            const uint8_t* row = in + y * width;
+            const uint8_t* below = in + (y < height - 1 ? y + 1 : height - 1) * width;
+            
+            for (int x = 0; x < width; x++) {
+                const int left = x > 0 ? x - 1 : 0;
+                const int right = x < width - 1 ? x + 1 : width - 1;
+                
+                unsigned int sum = above[left] + 2 * above[x] + above[right]
+                                 + 2 * (row[left] + 2 * row[x] + row[right])
+                                 + below[left] + 2 * below[x] + below[right];
+                
+                out[y * width + x] = (sum + 8) >> 4;
+            }
+        }
+    }
+    
+    void integralImage (const uint8_t* in, uint32_t* sum, uint32_t* sq_sum, int width, int height) {
+        const int pitch = width + 1;
+        
+        /* Rows are independent */
+#pragma omp parallel for
+        for (int y = 0; y <= height; y++) {
+            uint32_t* row = sum + y * pitch;
+            uint32_t* sq_row = sq_sum ? sq_sum + y * pitch : NULL;
+            uint32_t total = 0, sq_total = 0;
+            
+            row[0] = 0;
+            if (sq_row)
+                sq_row[0] = 0;
+            
+            for (int x = 0; x < width; x++) {
+                const uint32_t value = y > 0 ? in[(y - 1) * width + x] : 0;
+                
+                total += value;
+                row[x + 1] = total;
+                
+                if (sq_row) {
+                    sq_total += value * value;
+                    sq_row[x + 1] = sq_total;
+                }
+            }
+        }
+        
+        /* Columns are independent too, each thread adds rows over its own strip of columns */
+        const int strip = 256;
+        
+#pragma omp parallel for
+        for (int x0 = 0; x0 < pitch; x0 += strip) {
+            const int x1 = x0 + strip < pitch ? x0 + strip : pitch;
+            
+            for (int y = 1; y <= height; y++) {
+                uint32_t* above = sum + (y - 1) * pitch;
+                uint32_t* row = sum + y * pitch;
+                
+                for (int x = x0; x < x1; x++)
+                    row[x] += above[x];
+                
+                if (sq_sum) {
+                    uint32_t* sq_above = sq_sum + (y - 1) * pitch;
+                    uint32_t* sq_row = sq_sum + y * pitch;
+                    
+                    for (int x = x0; x < x1; x++)
+                        sq_row[x] += sq_above[x];
+                }
+            }
+        }
+    }
+    
+    /* Sum of window x window pixels with top left corner (x, y) */
+    static inline uint32_t windowSum (const uint32_t* table, int pitch, int x, int y, int window) {
+        return table[(y + window) * pitch + x + window] - table[y * pitch + x + window]
+             - table[(y + window) * pitch + x] + table[y * pitch + x];
+    }
+    
+    void boxFilter (const uint32_t* sum, uint8_t* out, int in_width, int width, int height, int window) {
+        const uint32_t area = window * window;
+        
+#pragma omp parallel for
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                out[y * width + x] = (windowSum(sum, in_width + 1, x, y, window) + area / 2) / area;
+    }
+    
+    void meanVariance (const uint32_t* sum, const uint32_t* sq_sum, float* mean, float* variance,
+                       int in_width, int width, int height, int window) {
+        const uint64_t area = window * window;
+        
+#pragma omp parallel for
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) {
+                const uint64_t s = windowSum(sum, in_width + 1, x, y, window);
+                const uint64_t sq = windowSum(sq_sum, in_width + 1, x, y, window);
+                
+                /* area^2 * variance = area * sum of squares - sum^2, exact in 64 bits */
+                mean[y * width + x] = (float)s / (float)area;
+                variance[y * width + x] = (float)(area * sq - s * s) / (float)(area * area);
+            }
+    }
+    
+    /* Returns smallest value whose cumulative count exceeds rank */
+    static inline uint8_t histogramRank (const uint16_t* histogram, int rank) {
+        int count = 0;
+        for (int value = 0; value < 255; value++) {
+            count += histogram[value];
+            if (count > rank)
+                return value;
+        }
+        return 255;
+    }
+    
+    void rankFilter (const uint8_t* in, uint8_t* out, int in_width, int width, int height, int radius, int rank) {
+        const int window = 2 * radius + 1;
+        const int in_columns = width + window - 1;
+        
+        /* Each thread slides its own histograms down a stripe of rows */
+        int threads = omp_get_max_threads();
+        int stripe = (height + threads - 1) / threads;
+        
+#pragma omp parallel for num_threads(threads)
+        for (int y0 = 0; y0 < height; y0 += stripe) {
+            const int y1 = y0 + stripe < height ? y0 + stripe : height;
+            
+            std::vector<uint16_t> columns (in_columns * 256, 0);
+            uint16_t histogram[256];
+            
+            for (int yy = 0; yy < window; yy++)
+                for (int x = 0; x < in_columns; x++)
+                    columns[x * 256 + in[(y0 + yy) * in_width + x]]++;
+            
+            for (int y = y0; y < y1; y++) {
+                /* Column histograms move one row down */
+                if (y > y0)
+                    for (int x = 0; x < in_columns; x++) {
+                        columns[x * 256 + in[(y - 1) * in_width + x]]--;
+                        columns[x * 256 + in[(y + window - 1) * in_width + x]]++;
+                    }
+                
+                std::fill(histogram, histogram + 256, 0);
+                for (int x = 0; x < window; x++)
+                    for (int value = 0; value < 256; value++)
+                        histogram[value] += columns[x * 256 + value];
+                
+                out[y * width] = histogramRank(histogram, rank);
+                
+                /* Window histogram moves one column right: add the new column, remove the old one */
+                for (int x = 1; x < width; x++) {
+                    const uint16_t* added = &columns[(x + window - 1) * 256];
+                    const uint16_t* removed = &columns[(x - 1) * 256];
+                    
+                    for (int value = 0; value < 256; value++)
+                        histogram[value] += added[value] - removed[value];
+                    
+                    out[y * width + x] = histogramRank(histogram, rank);
+                }
+            }
+        }
+    }
 }
@@ -11,6 +11,7 @@
 #include <stdint.h>
 
 namespace seminar {
+    class WorkerPool;
     
     /*! Non-Maxima Suppresion algorithm implemented as in libviso2 (matcher.cpp) but
      *  does NMS (maxumim only) for one image. Function in libviso2 simultaneously 
@@ -20,9 +21,68 @@ namespace seminar {
      */
     void nsm (uint8_t* image, unsigned int width, unsigned int height, uint8_t* maxima, unsigned int nms_n);
     
+    /*! Same as above, with columns of blocks scheduled on the worker pool.
+     */
+    void nsm (WorkerPool& pool, const uint8_t* image, unsigned int width, unsigned int height, uint8_t* maxima, unsigned int nms_n);
+    
+    /*! Same result as nsm, but cost per pixel does not depend on nms_n.
+     *
+     *  Instead of checking the (2n+1)^2 neighbourhood of each candidate, the image is
+     *  dilated with separable running max (van Herk / Gil-Werman, about 3 comparisons
+     *  per pixel and pass) and each block's maximum is kept if it equals the dilated
+     *  value.
+     */
+    void nsmRunningMax (const uint8_t* image, unsigned int width, unsigned int height, uint8_t* maxima, unsigned int nms_n);
+    
     /*! Simple 2D convolution algorithm
      */
     void convolution2d (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height, int kernel_size);
+    
+    /*! Same as above, with bands of rows scheduled on the worker pool.
+     */
+    void convolution2d (WorkerPool& pool, const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height,
+                        int kernel_size);
+    
+    /*! Same result as convolution2d, computes 16 pixels of a row at once with SSE2
+     *  (falls back to the scalar loop when compiled without SSE2).
+     */
+    void convolution2dSimd (const uint8_t* in, uint8_t* out, const uint8_t* kernel, int in_width, int width, int height,
+                            int kernel_size);
+    
+    /*! 3x3 binomial smoothing, output has the same size as input (border pixels are repeated)
+     */
+    void smooth3x3 (const uint8_t* in, uint8_t* out, int width, int height);
+    
+    /*! Integral image (summed-area table) of 8-bit image, and optionally of its squares.
+     *  Tables have (width + 1) x (height + 1) entries, entry (x, y) holds the sum of pixels
+     *  above and to the left of pixel (x, y). Sums are modulo 2^32, so sums over windows
+     *  are exact as long as they fit into 32 bits (windows of up to 257x257 for squares).
+     *  Rows are scanned in parallel, then columns.
+     *
+     *  \param sq_sum May be NULL.
+     */
+    void integralImage (const uint8_t* in, uint32_t* sum, uint32_t* sq_sum, int width, int height);
+    
+    /*! Valid box filter: rounded mean of window x window pixels, read from the integral
+     *  image of in_width wide image with four lookups per pixel.
+     */
+    void boxFilter (const uint32_t* sum, uint8_t* out, int in_width, int width, int height, int window);
+    
+    /*! Valid local mean and variance of window x window pixels, read from the integral
+     *  images of pixels and their squares.
+     */
+    void meanVariance (const uint32_t* sum, const uint32_t* sq_sum, float* mean, float* variance,
+                       int in_width, int width, int height, int window);
+    
+    /*! Valid rank filter with the same buffer conventions as convolution2d: each output
+     *  pixel is the rank-th smallest value of the (2 * radius + 1)^2 input pixels below
+     *  and to the right of it (rank = 2 * radius * (radius + 1) gives the median).
+     *
+     *  Uses per-column histograms that slide down the image and a window histogram that
+     *  slides along the row (Perreault and Hebert, "Median Filtering in Constant Time"),
+     *  so cost per pixel does not depend on radius. Radius must be at most 127.
+     */
+    void rankFilter (const uint8_t* in, uint8_t* out, int in_width, int width, int height, int radius, int rank);
 }
 
 #endif
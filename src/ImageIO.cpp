@@ -0,0 +1,394 @@
+//
+//  ImageIO.cpp
+//  Seminar
+//
+
+#include <stdexcept>
+#include <string>
+#include <new>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "oclw/Controller.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Exception.h"
+
+#include "ImageIO.h"
+
+namespace seminar {
+
+    static const size_t page_size = 4096;
+
+    /* libpng reports errors with longjmp. Functions below catch it with setjmp
+     * right where libpng is called and convert it to an exception, so no C++
+     * object is ever skipped by longjmp.
+     */
+
+    /* PNG stores 16-bit samples big endian */
+    static void swapToHostOrder (png_structp png) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        png_set_swap(png);
+#endif
+    }
+
+    PngReader::PngReader (const char* path, bool to_gray) : _file (NULL), _png (NULL), _info (NULL) {
+        _file = fopen(path, "rb");
+        if (_file == NULL)
+            throw std::runtime_error(std::string("Could not open ") + path);
+
+        png_byte signature[8];
+        if (fread(signature, 1, 8, _file) != 8 || png_sig_cmp(signature, 0, 8) != 0) {
+            fclose(_file);
+            throw std::runtime_error(std::string("Not a PNG file: ") + path);
+        }
+
+        _png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        _info = _png ? png_create_info_struct(_png) : NULL;
+
+        if (_info == NULL || setjmp(png_jmpbuf(_png))) {
+            png_destroy_read_struct(&_png, &_info, NULL);
+            fclose(_file);
+            throw std::runtime_error(std::string("Could not read PNG header: ") + path);
+        }
+
+        png_init_io(_png, _file);
+        png_set_sig_bytes(_png, 8);
+        png_read_info(_png, _info);
+
+        _width = png_get_image_width(_png, _info);
+        _height = png_get_image_height(_png, _info);
+
+        /* Let libpng convert whatever is in the file to 8-bit gray, or to 8/16-bit samples */
+        int color_type = png_get_color_type(_png, _info);
+        int bit_depth = png_get_bit_depth(_png, _info);
+
+        if (color_type == PNG_COLOR_TYPE_PALETTE)
+            png_set_palette_to_rgb(_png);
+        if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+            png_set_expand_gray_1_2_4_to_8(_png);
+
+        if (to_gray) {
+            if (bit_depth == 16)
+                png_set_strip_16(_png);
+            /* Also drops alpha made from a tRNS chunk by png_set_palette_to_rgb */
+            png_set_strip_alpha(_png);
+            if (color_type & PNG_COLOR_MASK_COLOR)
+                png_set_rgb_to_gray_fixed(_png, 1, -1, -1);
+        } else if (bit_depth == 16) {
+            swapToHostOrder(_png);
+        }
+
+        /* Interlaced images are decoded in several passes over the same rows */
+        _passes = png_set_interlace_handling(_png);
+        png_read_update_info(_png, _info);
+
+        _channels = png_get_channels(_png, _info);
+        _sample_size = png_get_bit_depth(_png, _info) / 8;
+
+        if (to_gray && (_channels != 1 || _sample_size != 1)) {
+            png_destroy_read_struct(&_png, &_info, NULL);
+            fclose(_file);
+            throw std::runtime_error(std::string("Could not convert PNG to 8-bit gray: ") + path);
+        }
+    }
+
+    PngReader::~PngReader () {
+        png_destroy_read_struct(&_png, &_info, NULL);
+        fclose(_file);
+    }
+
+    unsigned int PngReader::width () const {
+        return _width;
+    }
+
+    unsigned int PngReader::height () const {
+        return _height;
+    }
+
+    unsigned int PngReader::channels () const {
+        return _channels;
+    }
+
+    unsigned int PngReader::sampleSize () const {
+        return _sample_size;
+    }
+
+    void PngReader::read (uint8_t* buffer, size_t pitch, unsigned int rows) {
+        size_t row_size = (size_t)_width * _channels * _sample_size;
+
+        if (pitch < row_size || rows < _height)
+            throw std::runtime_error("Buffer is smaller than image.");
+
+        if (setjmp(png_jmpbuf(_png)))
+            throw std::runtime_error("Could not decode PNG image.");
+
+        for (int pass = 0; pass < _passes; pass++)
+            for (unsigned int y = 0; y < _height; y++)
+                png_read_row(_png, buffer + y * pitch, NULL);
+
+        /* Padding */
+        if (pitch > row_size)
+            for (unsigned int y = 0; y < _height; y++)
+                memset(buffer + y * pitch + row_size, 0, pitch - row_size);
+
+        memset(buffer + _height * pitch, 0, (rows - _height) * pitch);
+    }
+
+    void writePng (const char* path, const uint8_t* buffer, size_t pitch, unsigned int width, unsigned int height,
+                   unsigned int channels, unsigned int sample_size) {
+        static const int color_types[] = { PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA };
+
+        if (channels < 1 || channels > 4 || (sample_size != 1 && sample_size != 2))
+            throw std::runtime_error("Unsupported pixel format.");
+
+        FILE* file = fopen(path, "wb");
+        if (file == NULL)
+            throw std::runtime_error(std::string("Could not create ") + path);
+
+        png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        png_infop info = png ? png_create_info_struct(png) : NULL;
+
+        if (info == NULL || setjmp(png_jmpbuf(png))) {
+            png_destroy_write_struct(&png, &info);
+            fclose(file);
+            throw std::runtime_error(std::string("Could not write PNG image: ") + path);
+        }
+
+        png_init_io(png, file);
+        png_set_IHDR(png, info, width, height, 8 * sample_size, color_types[channels - 1], PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+
+        if (sample_size == 2)
+            swapToHostOrder(png);
+
+        for (unsigned int y = 0; y < height; y++)
+            png_write_row(png, (png_bytep)(buffer + y * pitch));
+
+        png_write_end(png, NULL);
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+    }
+
+    uint8_t* allocateAligned (size_t size) {
+        void* data;
+
+        if (posix_memalign(&data, page_size, size) != 0)
+            throw std::bad_alloc();
+
+        return (uint8_t*)data;
+    }
+
+    HostImageBuffer::HostImageBuffer (size_t size, oclw::Controller* controller)
+        : _controller (controller), _pinned (NULL), _data (NULL) {
+        if (controller != NULL) {
+            try {
+                _pinned = controller->createMemoryBuffer(oclw::MemoryBuffer::PINNED, size);
+                _data = (uint8_t*)_pinned->map();
+            } catch (oclw::Exception e) {
+                /* Fall back to pageable memory */
+                if (_pinned != NULL)
+                    controller->release(_pinned);
+                _pinned = NULL;
+            }
+        }
+
+        if (_data == NULL)
+            _data = allocateAligned(size);
+    }
+
+    HostImageBuffer::~HostImageBuffer () {
+        if (_pinned != NULL) {
+            try {
+                _pinned->unmap(_data);
+            } catch (oclw::Exception e) {
+                /* Buffer is released below anyway */
+            }
+            _controller->release(_pinned);
+        } else
+            free(_data);
+    }
+
+    uint8_t* HostImageBuffer::data () const {
+        return _data;
+    }
+
+    bool HostImageBuffer::pinned () const {
+        return _pinned != NULL;
+    }
+
+    /* Reads next decimal number from PGM header, skipping whitespace and comments.
+     */
+    static bool readPgmNumber (const char* header, size_t size, size_t& pos, unsigned int& value) {
+        while (pos < size) {
+            if (header[pos] == '#') {
+                while (pos < size && header[pos] != '\n')
+                    pos++;
+            } else if (isspace((unsigned char)header[pos])) {
+                pos++;
+            } else {
+                break;
+            }
+        }
+
+        if (pos >= size || !isdigit((unsigned char)header[pos]))
+            return false;
+
+        value = 0;
+        while (pos < size && isdigit((unsigned char)header[pos]))
+            value = value * 10 + (header[pos++] - '0');
+
+        return true;
+    }
+
+    MappedImage::MappedImage () : _mapping (NULL), _mapping_size (0), _data (NULL), _width (0), _height (0) {
+    }
+
+    MappedImage::MappedImage (const char* path, unsigned int width, unsigned int height)
+        : _mapping (NULL), _mapping_size (0), _data (NULL), _width (width), _height (height) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::string("Could not open ") + path);
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            close(fd);
+            throw std::runtime_error(std::string("Could not stat ") + path);
+        }
+
+        try {
+            map(fd, file_stat.st_size, false);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        const char* bytes = (const char*)_mapping;
+        size_t offset = 0;
+        const char* error = NULL;
+
+        if (_mapping_size >= 2 && bytes[0] == 'P' && bytes[1] == '5') {
+            unsigned int max_value;
+            offset = 2;
+
+            if (!readPgmNumber(bytes, _mapping_size, offset, _width) ||
+                !readPgmNumber(bytes, _mapping_size, offset, _height) ||
+                !readPgmNumber(bytes, _mapping_size, offset, max_value))
+                error = "Invalid PGM header: ";
+            else if (max_value > 255)
+                error = "Only 8-bit PGM images are supported: ";
+
+            /* Single whitespace separates header from pixels */
+            offset++;
+        } else if (_width == 0 || _height == 0) {
+            error = "Size of raw image must be given: ";
+        }
+
+        if (error == NULL && offset + (size_t)_width * _height > _mapping_size)
+            error = "File is smaller than image: ";
+
+        if (error != NULL) {
+            munmap(_mapping, _mapping_size);
+            throw std::runtime_error(std::string(error) + path);
+        }
+
+        _data = (uint8_t*)_mapping + offset;
+        madvise(_mapping, _mapping_size, MADV_SEQUENTIAL);
+    }
+
+    MappedImage::~MappedImage () {
+        if (_mapping != NULL)
+            munmap(_mapping, _mapping_size);
+    }
+
+    void MappedImage::map (int fd, size_t size, bool writable) {
+        /* Read mappings are private so a device using them as storage can never modify the file */
+        void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+
+        if (size == 0 || mapping == MAP_FAILED)
+            throw std::runtime_error("Could not map image file.");
+
+        _mapping = mapping;
+        _mapping_size = size;
+    }
+
+    MappedImage* MappedImage::create (const char* path, unsigned int width, unsigned int height) {
+        size_t length = strlen(path);
+        bool pgm = length > 4 && strcasecmp(path + length - 4, ".pgm") == 0;
+
+        /* Comment pads PGM header to a page, so pixel data is page aligned */
+        std::string header;
+        if (pgm) {
+            char size_line[64];
+            snprintf(size_line, sizeof(size_line), "%u %u\n255\n", width, height);
+
+            header = "P5\n#";
+            header.append(page_size - header.size() - 1 - strlen(size_line), ' ');
+            header += "\n";
+            header += size_line;
+        }
+
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error(std::string("Could not create ") + path);
+
+        size_t file_size = header.size() + (size_t)width * height;
+        MappedImage* image = new MappedImage;
+
+        try {
+            if (ftruncate(fd, file_size) != 0)
+                throw std::runtime_error(std::string("Could not resize ") + path);
+
+            image->map(fd, file_size, true);
+        } catch (...) {
+            close(fd);
+            delete image;
+            throw;
+        }
+        close(fd);
+
+        memcpy(image->_mapping, header.data(), header.size());
+        image->_data = (uint8_t*)image->_mapping + header.size();
+        image->_width = width;
+        image->_height = height;
+
+        return image;
+    }
+
+    uint8_t* MappedImage::data () const {
+        return _data;
+    }
+
+    unsigned int MappedImage::width () const {
+        return _width;
+    }
+
+    unsigned int MappedImage::height () const {
+        return _height;
+    }
+
+    size_t MappedImage::size () const {
+        return (size_t)_width * _height;
+    }
+
+    bool MappedImage::pageAligned () const {
+        return ((uintptr_t)_data % page_size) == 0;
+    }
+
+    oclw::MemoryBuffer* MappedImage::upload (oclw::Controller* controller) const {
+        if (pageAligned())
+            return controller->createMemoryBuffer(oclw::MemoryBuffer::HOST, size(), _data);
+
+        oclw::MemoryBuffer* buffer = controller->createMemoryBuffer(oclw::MemoryBuffer::READ, size());
+        buffer->writeData(_data, size());
+        return buffer;
+    }
+}
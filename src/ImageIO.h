@@ -0,0 +1,171 @@
+//
+//  ImageIO.h
+//  Seminar
+//
+
+#ifndef Seminar_ImageIO_h
+#define Seminar_ImageIO_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <png.h>
+
+namespace oclw {
+    class Controller;
+    class MemoryBuffer;
+}
+
+namespace seminar {
+
+    /*! Reads image from a PNG file directly into a caller provided buffer.
+     *
+     *  Usage: construct reader (reads header), query size, allocate buffer, call read().
+     *  By default, color, palette, alpha and 16-bit images are converted to 8-bit gray
+     *  by libpng while decoding, so no per-pixel pass is needed afterwards. Otherwise
+     *  pixels keep their channels (gray, gray + alpha, RGB or RGBA) and bit depth
+     *  (8 or 16, in host byte order), interleaved; only palettes and gray images of
+     *  less than 8 bits are expanded.
+     *  Errors are reported with std::runtime_error.
+     */
+    class PngReader {
+    private:
+        FILE* _file;
+        png_structp _png;
+        png_infop _info;
+        unsigned int _width;
+        unsigned int _height;
+        unsigned int _channels;
+        unsigned int _sample_size;
+        int _passes;
+
+    public:
+        /*! Opens file and reads PNG header.
+         *
+         *  \param to_gray If true, image is decoded as 8-bit gray.
+         */
+        PngReader (const char* path, bool to_gray = true);
+        ~PngReader ();
+
+        unsigned int width () const;
+        unsigned int height () const;
+
+        /*! Returns number of samples per decoded pixel (1 to 4).
+         */
+        unsigned int channels () const;
+
+        /*! Returns size of one decoded sample in bytes (1 or 2).
+         */
+        unsigned int sampleSize () const;
+
+        /*! Decodes image rows into buffer.
+         *
+         *  Image occupies top left corner of the buffer. Remaining columns of each row and
+         *  remaining rows are set to zero, so padding is written exactly once.
+         *
+         *  \param buffer Destination buffer of at least pitch * rows bytes.
+         *  \param pitch Distance between starts of two rows in bytes (>= width() * channels() * sampleSize()).
+         *  \param rows Number of rows in buffer (>= height()).
+         */
+        void read (uint8_t* buffer, size_t pitch, unsigned int rows);
+    };
+
+    /*! Writes image stored in a pitched buffer to a PNG file.
+     *  Rows are passed to libpng directly, without intermediate copy.
+     *
+     *  \param channels 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA), interleaved.
+     *  \param sample_size 1 or 2 bytes, 16-bit samples are in host byte order.
+     */
+    void writePng (const char* path, const uint8_t* buffer, size_t pitch, unsigned int width, unsigned int height,
+                   unsigned int channels = 1, unsigned int sample_size = 1);
+
+    /*! Page aligned host memory for images that are transferred to the OpenCL device.
+     *
+     *  If controller is given, memory is allocated as pinned (MemoryBuffer::PINNED) and
+     *  mapped, which makes transfers from it fastest. If that is not available, plain
+     *  page aligned memory is allocated instead.
+     */
+    class HostImageBuffer {
+    private:
+        oclw::Controller* _controller;
+        oclw::MemoryBuffer* _pinned;
+        uint8_t* _data;
+
+        HostImageBuffer (const HostImageBuffer&);
+        HostImageBuffer& operator= (const HostImageBuffer&);
+
+    public:
+        HostImageBuffer (size_t size, oclw::Controller* controller = NULL);
+        ~HostImageBuffer ();
+
+        uint8_t* data () const;
+
+        /*! Returns true if memory is pinned.
+         */
+        bool pinned () const;
+    };
+
+    /*! Allocates page aligned memory. Release it with free().
+     */
+    uint8_t* allocateAligned (size_t size);
+
+    /*! 8-bit grayscale image in a raw or binary PGM (P5) file, mapped into memory.
+     *
+     *  Pixels are accessed directly in the page cache, so a frame goes from disk to
+     *  the OpenCL device (and back) without intermediate host copy.
+     *  PGM files written by create() have header padded to a page, so their pixel
+     *  data is page aligned too and can be used by the device without any copy.
+     *  Errors are reported with std::runtime_error.
+     */
+    class MappedImage {
+    private:
+        void* _mapping;
+        size_t _mapping_size;
+        uint8_t* _data;
+        unsigned int _width;
+        unsigned int _height;
+
+        MappedImage ();
+        MappedImage (const MappedImage&);
+        MappedImage& operator= (const MappedImage&);
+
+        void map (int fd, size_t size, bool writable);
+
+    public:
+        /*! Maps existing image file. PGM files are recognized by their header. Files
+         *  without header are raw planes and their size must be given.
+         *  Mapping is private, changes made through data() are never written to the file.
+         */
+        MappedImage (const char* path, unsigned int width = 0, unsigned int height = 0);
+
+        ~MappedImage ();
+
+        /*! Creates (or truncates) image file of given size and maps it for writing.
+         *  Files with .pgm extension get a PGM header, others are written as raw planes.
+         *  Pixels written through data() end up in the file.
+         */
+        static MappedImage* create (const char* path, unsigned int width, unsigned int height);
+
+        uint8_t* data () const;
+        unsigned int width () const;
+        unsigned int height () const;
+
+        /*! Returns size of pixel data in bytes.
+         */
+        size_t size () const;
+
+        /*! Returns true if pixel data starts at page boundary.
+         */
+        bool pageAligned () const;
+
+        /*! Creates memory buffer with image data on the OpenCL device.
+         *
+         *  If pixel data is page aligned, mapping itself is used as buffer storage
+         *  (MemoryBuffer::HOST), otherwise data is copied in with one transfer.
+         *  Image must outlive returned buffer. Caller owns the buffer.
+         */
+        oclw::MemoryBuffer* upload (oclw::Controller* controller) const;
+    };
+}
+
+#endif
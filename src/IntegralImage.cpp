@@ -0,0 +1,80 @@
+//
+//  IntegralImage.cpp
+//  Seminar
+//
+
+#include <algorithm>
+
+#include "oclw/Exception.h"
+
+#include "IntegralImage.h"
+
+namespace seminar {
+
+    /* Largest power of two up to limit, the scan in integral_rows doubles its stride */
+    static size_t scanSize (size_t limit) {
+        size_t size = 1;
+        while (size * 2 <= limit && size * 2 <= 256)
+            size *= 2;
+        return size;
+    }
+
+    IntegralImage::IntegralImage (oclw::Controller* controller, oclw::Program* program)
+        : _controller (controller),
+          _rows (program->createKernel("integral_rows")),
+          _columns (program->createKernel("integral_columns")),
+          _box_filter (program->createKernel("box_filter")),
+          _mean_variance (program->createKernel("mean_variance")),
+          _sum (controller->createMemoryBuffer()),
+          _sq_sum (controller->createMemoryBuffer()),
+          _width (0), _height (0), _squares (false) {
+        _scan_size = scanSize(std::min(_rows->workGroupSize(), controller->getInfo().max_work_item_sizes[0]));
+    }
+
+    void IntegralImage::scan (oclw::MemoryBuffer& image, oclw::MemoryBuffer& table, bool square) {
+        _rows->launch(oclw::Kernel::NDRange::range2D(_scan_size, _height), oclw::Kernel::NDRange::range2D(_scan_size, 1),
+                      image, table, _width, _height, (int)square, oclw::Local(_scan_size * sizeof(cl_uint)));
+        _columns->launch(oclw::Kernel::NDRange::range1D(_width + 1), table, _width, _height);
+    }
+
+    void IntegralImage::build (oclw::MemoryBuffer& image, int width, int height, bool squares) {
+        size_t table_size = (size_t)(width + 1) * (height + 1) * sizeof(cl_uint);
+
+        _width = width;
+        _height = height;
+        _squares = squares;
+
+        _sum->reserve(oclw::MemoryBuffer::READ_WRITE, table_size);
+        scan(image, *_sum, false);
+
+        if (squares) {
+            _sq_sum->reserve(oclw::MemoryBuffer::READ_WRITE, table_size);
+            scan(image, *_sq_sum, true);
+        }
+    }
+
+    oclw::MemoryBuffer& IntegralImage::sum () {
+        return *_sum;
+    }
+
+    oclw::MemoryBuffer& IntegralImage::sqSum () {
+        return *_sq_sum;
+    }
+
+    void IntegralImage::boxFilter (oclw::MemoryBuffer& out, int width, int height, int window) {
+        if (width + window - 1 > _width || height + window - 1 > _height)
+            throw oclw::Exception("Box filter output is larger than the built image allows.");
+
+        _box_filter->launch(oclw::Kernel::NDRange::range2D(width, height), *_sum, out, _width, width, height, window);
+    }
+
+    void IntegralImage::meanVariance (oclw::MemoryBuffer& mean, oclw::MemoryBuffer& variance, int width, int height, int window) {
+        if (!_squares)
+            throw oclw::Exception("Integral image was built without squares.");
+        if (width + window - 1 > _width || height + window - 1 > _height)
+            throw oclw::Exception("Mean and variance output is larger than the built image allows.");
+
+        _mean_variance->launch(oclw::Kernel::NDRange::range2D(width, height), *_sum, *_sq_sum, mean, variance,
+                               _width, width, height, window);
+    }
+}
@@ -0,0 +1,89 @@
+//
+//  IntegralImage.h
+//  Seminar
+//
+
+#ifndef Seminar_IntegralImage_h
+#define Seminar_IntegralImage_h
+
+#include <stddef.h>
+
+#include "oclw/Controller.h"
+#include "oclw/Program.h"
+#include "oclw/Kernel.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Handle.h"
+
+namespace seminar {
+
+    /*! Integral image of an 8-bit image on the OpenCL device, and filters that
+     *  read it with four lookups per pixel, so their cost does not depend on
+     *  window size. Results are identical to seminar::integralImage and
+     *  seminar::boxFilter; seminar::meanVariance may differ in the last bit,
+     *  since OpenCL division is not correctly rounded.
+     *
+     *  Table is built with a parallel scan of rows (one work group per row)
+     *  followed by a scan of columns. Operations are only enqueued:
+     *
+     *  \code
+     *  seminar::IntegralImage integral (controller, program);
+     *  integral.build(*image, width, height);
+     *  integral.boxFilter(*output, width, width - 30, height - 30, 31);
+     *  output->readData(result, (width - 30) * (height - 30));
+     *  \endcode
+     */
+    class IntegralImage {
+    private:
+        oclw::Controller* _controller;
+
+        oclw::Handle<oclw::Kernel> _rows;
+        oclw::Handle<oclw::Kernel> _columns;
+        oclw::Handle<oclw::Kernel> _box_filter;
+        oclw::Handle<oclw::Kernel> _mean_variance;
+
+        oclw::Handle<oclw::MemoryBuffer> _sum;
+        oclw::Handle<oclw::MemoryBuffer> _sq_sum;
+
+        size_t _scan_size;
+        int _width, _height;
+        bool _squares;
+
+        IntegralImage (const IntegralImage&);
+        IntegralImage& operator= (const IntegralImage&);
+
+        /* Enqueues both passes for one table */
+        void scan (oclw::MemoryBuffer& image, oclw::MemoryBuffer& table, bool square);
+
+    public:
+        /*! \param program Program built from cl_program.cl. Object creates its own kernels.
+         */
+        IntegralImage (oclw::Controller* controller, oclw::Program* program);
+
+        /*! Enqueues building of (width + 1) x (height + 1) table of 32-bit sums (modulo 2^32).
+         *
+         *  \param squares If true, table of sums of squares is built too (needed by meanVariance()).
+         */
+        void build (oclw::MemoryBuffer& image, int width, int height, bool squares = false);
+
+        /*! Table of sums, valid after build().
+         */
+        oclw::MemoryBuffer& sum ();
+
+        /*! Table of sums of squares, valid after build() with squares.
+         */
+        oclw::MemoryBuffer& sqSum ();
+
+        /*! Enqueues valid box filter of built image, see seminar::boxFilter.
+         */
+        void boxFilter (oclw::MemoryBuffer& out, int width, int height, int window);
+
+        /*! Enqueues valid local mean and variance of built image, see seminar::meanVariance.
+         *
+         *  \param mean Receives width x height floats.
+         *  \param variance Receives width x height floats.
+         */
+        void meanVariance (oclw::MemoryBuffer& mean, oclw::MemoryBuffer& variance, int width, int height, int window);
+    };
+}
+
+#endif
@@ -0,0 +1,267 @@
+//
+//  KernelPlanner.cpp
+//  Seminar
+//
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include "oclw/Program.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Exception.h"
+
+#include "KernelPlanner.h"
+
+namespace seminar {
+
+    static const char* variantName (KernelPlanner::Variant variant) {
+        switch (variant) {
+            case KernelPlanner::NAIVE: return "naive";
+            case KernelPlanner::TILED: return "tiled";
+            case KernelPlanner::VECTORIZED: return "vectorized";
+            case KernelPlanner::IMAGE: return "image";
+            case KernelPlanner::SEPARABLE: return "separable";
+        }
+
+        return "unknown";
+    }
+
+    KernelPlanner::Plan::Plan () : operation (""), variant (NAIVE), kernel (NULL),
+        global_size (oclw::Kernel::NDRange::range1D(1)), local_size (oclw::Kernel::NDRange::range1D(1)),
+        has_local_size (false), local_mem_bytes (0) {}
+
+    void KernelPlanner::Plan::print () const {
+        std::cout << "Plan for " << operation << ": " << variantName(variant) << " kernel, global size ["
+                  << global_size.sizes()[0] << ", " << global_size.sizes()[1] << "]";
+
+        if (has_local_size)
+            std::cout << ", work group [" << local_size.sizes()[0] << ", " << local_size.sizes()[1] << "]";
+        if (local_mem_bytes > 0)
+            std::cout << ", " << local_mem_bytes << " bytes of local memory";
+
+        std::cout << std::endl;
+
+        for (size_t i = 0; i < reasons.size(); i++)
+            std::cout << "  - " << reasons[i] << std::endl;
+    }
+
+    KernelPlanner::KernelPlanner (oclw::Controller* controller, oclw::Program* program)
+        : _controller (controller), _info (controller->getInfo()),
+          _convolve2d (program->createKernel("convolve2d")),
+          _convolve2d_tiled (program->createKernel("convolve2d_tiled")),
+          _convolve2d_vec4 (program->createKernel("convolve2d_vec4")),
+          _nms (program->createKernel("nms")),
+          _running_max_rows (program->createKernel("running_max_rows")),
+          _running_max_columns (program->createKernel("running_max_columns")),
+          _nms_dilated (program->createKernel("nms_dilated")),
+          _rows (controller->createMemoryBuffer()),
+          _dilated (controller->createMemoryBuffer()) {}
+
+    bool KernelPlanner::pickTile (int kernel_size, size_t& tile_x, size_t& tile_y, std::string& reason) const {
+        static const size_t widths[] = { 64, 32, 16, 8 };
+        static const size_t heights[] = { 32, 16, 8, 4, 2, 1 };
+
+        /* Smaller groups spend most of their time copying the halo */
+        static const size_t min_items = 64;
+
+        size_t max_items = std::min(_info.max_work_group_size, _convolve2d_tiled->workGroupSize());
+        size_t multiple = std::max((size_t)1, _convolve2d_tiled->preferredWorkGroupSizeMultiple());
+
+        /* Half of local memory, so that two work groups can be resident on a compute unit */
+        size_t budget = _info.local_mem_size / 2;
+
+        size_t best_items = 0, best_bytes = 0;
+
+        for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++)
+            for (size_t j = 0; j < sizeof(heights) / sizeof(heights[0]); j++) {
+                size_t items = widths[i] * heights[j];
+                size_t bytes = (widths[i] + kernel_size - 1) * (heights[j] + kernel_size - 1);
+
+                if (items > max_items || widths[i] > _info.max_work_item_sizes[0] || heights[j] > _info.max_work_item_sizes[1] ||
+                    bytes > budget || items % multiple != 0)
+                    continue;
+
+                /* Largest group wins; among equal ones, the one with least halo */
+                if (items > best_items || (items == best_items && bytes < best_bytes)) {
+                    best_items = items;
+                    best_bytes = bytes;
+                    tile_x = widths[i];
+                    tile_y = heights[j];
+                }
+            }
+
+        std::ostringstream text;
+
+        if (best_items < min_items) {
+            text << "no work group of at least " << min_items << " work items (multiple of " << multiple
+                 << ") has its tile fit into half of " << _info.local_mem_size / 1024 << " KB of local memory";
+            reason = text.str();
+            return false;
+        }
+
+        text << "work group " << tile_x << "x" << tile_y << " is the largest within kernel limit of " << max_items
+             << " work items that is a multiple of " << multiple << " and whose " << best_bytes
+             << " byte tile fits into half of local memory; each input pixel is read from global memory once per work group instead of up to "
+             << kernel_size * kernel_size << " times";
+        reason = text.str();
+        return true;
+    }
+
+    void KernelPlanner::setConvolve2d (Plan& plan, Variant variant, int width, int height, int kernel_size,
+                                       size_t tile_x, size_t tile_y) const {
+        plan.variant = variant;
+
+        switch (variant) {
+            case TILED:
+                plan.kernel = _convolve2d_tiled.get();
+                plan.global_size = oclw::Kernel::NDRange::range2D((width + tile_x - 1) / tile_x * tile_x,
+                                                                  (height + tile_y - 1) / tile_y * tile_y);
+                plan.local_size = oclw::Kernel::NDRange::range2D(tile_x, tile_y);
+                plan.has_local_size = true;
+                plan.local_mem_bytes = (tile_x + kernel_size - 1) * (tile_y + kernel_size - 1);
+                break;
+            case VECTORIZED:
+                plan.kernel = _convolve2d_vec4.get();
+                plan.global_size = oclw::Kernel::NDRange::range2D((width + 3) / 4, height);
+                break;
+            default:
+                plan.kernel = _convolve2d.get();
+                plan.global_size = oclw::Kernel::NDRange::range2D(width, height);
+                break;
+        }
+    }
+
+    KernelPlanner::Plan KernelPlanner::planConvolve2d (int width, int height, int kernel_size) const {
+        Plan plan;
+        plan.operation = "convolve2d";
+
+        std::ostringstream device;
+        device << "device is " << (_info.type & CL_DEVICE_TYPE_GPU ? "a GPU" : _info.type & CL_DEVICE_TYPE_CPU ? "a CPU" : "an accelerator")
+               << " with " << (_info.local_mem_dedicated ? "dedicated" : "emulated") << " local memory of "
+               << _info.local_mem_size / 1024 << " KB and preferred char vector width " << _info.preferred_vector_width_char;
+        plan.reasons.push_back(device.str());
+
+        if (_info.image_support)
+            plan.reasons.push_back("device supports images, but image variant is not implemented");
+
+        size_t tile_x = 0, tile_y = 0;
+        std::string tile_reason;
+
+        if (kernel_size <= 1) {
+            plan.reasons.push_back("1x1 kernel reads each input pixel once, there is nothing to share in local memory");
+        } else if (!_info.local_mem_dedicated) {
+            plan.reasons.push_back("local memory lives in global memory (and its caches), tiling would only add copies");
+        } else if (pickTile(kernel_size, tile_x, tile_y, tile_reason)) {
+            plan.reasons.push_back(tile_reason);
+            setConvolve2d(plan, TILED, width, height, kernel_size, tile_x, tile_y);
+            return plan;
+        } else {
+            plan.reasons.push_back(tile_reason);
+        }
+
+        if (_info.preferred_vector_width_char >= 4 && width >= 4) {
+            plan.reasons.push_back("device prefers char vectors, each work item computes 4 pixels with vector loads");
+            setConvolve2d(plan, VECTORIZED, width, height, kernel_size, 0, 0);
+            return plan;
+        }
+
+        plan.reasons.push_back("device prefers scalar char operations, one work item per pixel");
+        setConvolve2d(plan, NAIVE, width, height, kernel_size, 0, 0);
+        return plan;
+    }
+
+    KernelPlanner::Plan KernelPlanner::planConvolve2d (int width, int height, int kernel_size, Variant variant) const {
+        Plan plan;
+        plan.operation = "convolve2d";
+        plan.reasons.push_back("variant was requested by the caller");
+
+        size_t tile_x = 0, tile_y = 0;
+        std::string tile_reason;
+
+        if (variant != NAIVE && variant != TILED && variant != VECTORIZED)
+            throw oclw::Exception(std::string("convolve2d has no ") + variantName(variant) + " variant");
+        if (variant == TILED && !pickTile(kernel_size, tile_x, tile_y, tile_reason))
+            throw oclw::Exception("Tiled convolve2d does not fit the device: " + tile_reason);
+
+        if (variant == TILED)
+            plan.reasons.push_back(tile_reason);
+
+        setConvolve2d(plan, variant, width, height, kernel_size, tile_x, tile_y);
+        return plan;
+    }
+
+    KernelPlanner::Plan KernelPlanner::planNms (unsigned int width, unsigned int height, unsigned int n) const {
+        Plan plan;
+        plan.operation = "nms";
+        plan.global_size = oclw::Kernel::NDRange::range2D((width - 2*n)/(n+1)+1, (height - 2*n)/(n+1)+1);
+
+        /* Naive work item verifies its block maximum against the whole neighbourhood */
+        size_t blocks = plan.global_size.sizes()[0] * plan.global_size.sizes()[1];
+        size_t reads = (n + 1) * (n + 1) + (2*n + 1) * (2*n + 1);
+        size_t resident = _info.compute_units * _info.max_work_group_size;
+
+        std::ostringstream text;
+        text << "naive nms has " << blocks << " work items reading up to " << reads << " pixels each, device keeps about "
+             << resident << " work items busy";
+        plan.reasons.push_back(text.str());
+
+        if (n >= 4 || blocks < resident) {
+            plan.reasons.push_back(n >= 4 ? "neighbourhood check dominates for n >= 4, separable running max needs about 3 comparisons per pixel and pass whatever n is"
+                                          : "too few blocks to fill the device, separable passes have more work items");
+
+            plan.variant = SEPARABLE;
+            plan.kernel = _nms_dilated.get();
+            return plan;
+        }
+
+        plan.reasons.push_back("one work item per (n+1)x(n+1) block is enough for small n and saves two passes over the image");
+
+        plan.variant = NAIVE;
+        plan.kernel = _nms.get();
+        return plan;
+    }
+
+    KernelPlanner::Plan KernelPlanner::planNms (unsigned int width, unsigned int height, unsigned int n, Variant variant) const {
+        if (variant != NAIVE && variant != SEPARABLE)
+            throw oclw::Exception(std::string("nms has no ") + variantName(variant) + " variant");
+
+        Plan plan;
+        plan.operation = "nms";
+        plan.global_size = oclw::Kernel::NDRange::range2D((width - 2*n)/(n+1)+1, (height - 2*n)/(n+1)+1);
+        plan.reasons.push_back("variant was requested by the caller");
+
+        plan.variant = variant;
+        plan.kernel = variant == SEPARABLE ? _nms_dilated.get() : _nms.get();
+        return plan;
+    }
+
+    void KernelPlanner::convolve2d (const Plan& plan, oclw::MemoryBuffer& in, oclw::MemoryBuffer& out, oclw::MemoryBuffer& conv_kernel,
+                                    int in_width, int width, int height, int kernel_size) {
+        if (plan.variant == TILED)
+            plan.kernel->launch(plan.global_size, plan.local_size, in, out, conv_kernel, in_width, width, height, kernel_size,
+                                oclw::Local(plan.local_mem_bytes));
+        else
+            plan.kernel->launch(plan.global_size, in, out, conv_kernel, in_width, width, height, kernel_size);
+    }
+
+    void KernelPlanner::nms (const Plan& plan, oclw::MemoryBuffer& image, oclw::MemoryBuffer& maxima,
+                             unsigned int width, unsigned int height, unsigned int n) {
+        if (plan.variant != SEPARABLE) {
+            plan.kernel->launch(plan.global_size, image, maxima, width, height, (int)n);
+            return;
+        }
+
+        size_t size = (size_t)width * height;
+        _rows->reserve(oclw::MemoryBuffer::READ_WRITE, size);
+        _dilated->reserve(oclw::MemoryBuffer::READ_WRITE, size);
+
+        /* Each running max work item handles one 2n+1 long segment */
+        size_t window = 2*n + 1;
+        _running_max_rows->launch(oclw::Kernel::NDRange::range2D((width + window - 1) / window, height),
+                                  image, *_rows, (int)width, (int)height, (int)n);
+        _running_max_columns->launch(oclw::Kernel::NDRange::range2D(width, (height + window - 1) / window),
+                                     *_rows, *_dilated, (int)width, (int)height, (int)n);
+        plan.kernel->launch(plan.global_size, image, *_dilated, maxima, width, height, (int)n);
+    }
+}
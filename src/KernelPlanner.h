@@ -0,0 +1,128 @@
+//
+//  KernelPlanner.h
+//  Seminar
+//
+
+#ifndef Seminar_KernelPlanner_h
+#define Seminar_KernelPlanner_h
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "oclw/Controller.h"
+#include "oclw/Kernel.h"
+#include "oclw/Handle.h"
+
+namespace seminar {
+
+    /*! Picks implementation of each OpenCL operation that suits the device.
+     *
+     *  Decision is based on device limits (local memory size and kind, work
+     *  group limits, preferred vector width, device type) and on the operation
+     *  itself. Each plan records why it was chosen, see Plan::print():
+     *
+     *  \code
+     *  seminar::KernelPlanner planner (controller, program);
+     *  seminar::KernelPlanner::Plan plan = planner.planConvolve2d(out_width, out_height, kernel_size);
+     *  plan.print();
+     *  planner.convolve2d(plan, *input, *output, *weights, in_width, out_width, out_height, kernel_size);
+     *  controller->finish();
+     *  \endcode
+     *
+     *  All variants produce identical results.
+     */
+    class KernelPlanner {
+    public:
+        enum Variant {
+            NAIVE,          /*!< One work item per output pixel, reads straight from global memory. */
+            TILED,          /*!< Work group shares its input block in local memory. */
+            VECTORIZED,     /*!< One work item per 4 output pixels, vector loads. */
+            IMAGE,          /*!< Input read through image sampler (not implemented, never chosen). */
+            SEPARABLE       /*!< Separable running max passes, cost per pixel independent of window size. */
+        };
+
+        /*! Chosen implementation of an operation and its launch geometry.
+         */
+        class Plan {
+        public:
+            const char* operation;
+            Variant variant;
+            oclw::Kernel* kernel;
+            oclw::Kernel::NDRange global_size;
+            oclw::Kernel::NDRange local_size;
+            bool has_local_size;                /*!< If false, OpenCL picks work group size. */
+            size_t local_mem_bytes;             /*!< Local memory used by one work group. */
+            std::vector<std::string> reasons;   /*!< Why variant and sizes were chosen. */
+
+            Plan ();
+
+            /*! Prints chosen variant, sizes and reasons.
+             */
+            void print () const;
+        };
+
+    private:
+        oclw::Controller* _controller;
+        oclw::Controller::Info _info;
+
+        oclw::Handle<oclw::Kernel> _convolve2d;
+        oclw::Handle<oclw::Kernel> _convolve2d_tiled;
+        oclw::Handle<oclw::Kernel> _convolve2d_vec4;
+        oclw::Handle<oclw::Kernel> _nms;
+        oclw::Handle<oclw::Kernel> _running_max_rows;
+        oclw::Handle<oclw::Kernel> _running_max_columns;
+        oclw::Handle<oclw::Kernel> _nms_dilated;
+
+        /* Intermediate images of separable nms, allocated on first use */
+        oclw::Handle<oclw::MemoryBuffer> _rows;
+        oclw::Handle<oclw::MemoryBuffer> _dilated;
+
+        /* Finds the largest work group whose tile fits into local memory.
+         * Returns false if none is large enough to be worth it.
+         */
+        bool pickTile (int kernel_size, size_t& tile_x, size_t& tile_y, std::string& reason) const;
+
+        /* Sets kernel and launch geometry of a convolve2d variant, tile is only used by TILED */
+        void setConvolve2d (Plan& plan, Variant variant, int width, int height, int kernel_size,
+                            size_t tile_x, size_t tile_y) const;
+
+    public:
+        /*! \param program Program built from cl_program.cl. Planner creates its own kernels.
+         */
+        KernelPlanner (oclw::Controller* controller, oclw::Program* program);
+
+        /*! Plans valid convolution producing width x height output.
+         */
+        Plan planConvolve2d (int width, int height, int kernel_size) const;
+
+        /*! Plans given variant of convolution whether it suits the device or not, so
+         *  that variants can be compared. Throws oclw::Exception if the variant is not
+         *  implemented or, for TILED, no work group tile fits into local memory.
+         */
+        Plan planConvolve2d (int width, int height, int kernel_size, Variant variant) const;
+
+        /*! Plans nms of width x height image with block size n.
+         */
+        Plan planNms (unsigned int width, unsigned int height, unsigned int n) const;
+
+        /*! Plans given variant of nms (NAIVE or SEPARABLE), see above.
+         */
+        Plan planNms (unsigned int width, unsigned int height, unsigned int n, Variant variant) const;
+
+        /*! Enqueues convolve2d as planned, without waiting. Arguments are the same
+         *  as for the convolve2d kernel.
+         */
+        void convolve2d (const Plan& plan, oclw::MemoryBuffer& in, oclw::MemoryBuffer& out, oclw::MemoryBuffer& conv_kernel,
+                         int in_width, int width, int height, int kernel_size);
+
+        /*! Enqueues nms as planned, without waiting. Arguments are the same as
+         *  for the nms kernel. Separable variant uses two image sized buffers of
+         *  the planner.
+         */
+        void nms (const Plan& plan, oclw::MemoryBuffer& image, oclw::MemoryBuffer& maxima,
+                  unsigned int width, unsigned int height, unsigned int n);
+    };
+}
+
+#endif
@@ -0,0 +1,202 @@
+//
+//  Matcher.cpp
+//  Seminar
+//
+
+#include <algorithm>
+#include <stdlib.h>
+#include <omp.h>
+
+#include "Matcher.h"
+
+namespace seminar {
+
+    /* Sample offsets (x, y) of descriptors, same as descriptor_pattern in cl_program.cl */
+    static const int8_t pattern[32][2] = {
+        {-4, -4}, {-2, -4}, { 0, -4}, { 2, -4}, { 4, -4},
+        {-4, -2}, {-2, -2}, { 0, -2}, { 2, -2}, { 4, -2},
+        {-4,  0}, {-2,  0}, { 0,  0}, { 2,  0}, { 4,  0},
+        {-4,  2}, {-2,  2}, { 0,  2}, { 2,  2}, { 4,  2},
+        {-4,  4}, {-2,  4}, { 0,  4}, { 2,  4}, { 4,  4},
+        {-1, -1}, { 1, -1}, {-1,  1}, { 1,  1}, { 0, -3}, {-3,  0}, { 3,  0}
+    };
+
+    static int sadDistance (const Descriptor& a, const Descriptor& b) {
+        int sum = 0;
+        for (int i = 0; i < 32; i++)
+            sum += abs(a.data[i] - b.data[i]);
+        return sum;
+    }
+
+    static int hammingDistance (const Descriptor& a, const Descriptor& b) {
+        int sum = 0;
+        for (int i = 0; i < 32; i++)
+            sum += __builtin_popcount(a.data[i] ^ b.data[i]);
+        return sum;
+    }
+
+    void describe (const uint8_t* image, unsigned int width, unsigned int height, const std::vector<Keypoint>& keypoints,
+                   DescriptorKind kind, std::vector<Descriptor>& descriptors) {
+        descriptors.resize(keypoints.size());
+
+#pragma omp parallel for
+        for (int k = 0; k < (int)keypoints.size(); k++) {
+            uint8_t samples[32];
+
+            for (int i = 0; i < 32; i++) {
+                int x = std::min(std::max(keypoints[k].x + pattern[i][0], 0), (int)width - 1);
+                int y = std::min(std::max(keypoints[k].y + pattern[i][1], 0), (int)height - 1);
+                samples[i] = image[y * width + x];
+            }
+
+            uint8_t* out = descriptors[k].data;
+
+            if (kind == SAD) {
+                std::copy(samples, samples + 32, out);
+                continue;
+            }
+
+            /* Bit b of byte 4r + p/8 compares sample p with sample p + 1 + 4r (mod 32) */
+            for (int byte = 0; byte < 32; byte++) {
+                int r = byte / 4;
+                uint8_t bits = 0;
+
+                for (int bit = 0; bit < 8; bit++) {
+                    int p = (byte % 4) * 8 + bit;
+                    bits |= (samples[p] < samples[(p + 1 + 4 * r) % 32]) << bit;
+                }
+
+                out[byte] = bits;
+            }
+        }
+    }
+
+    void matchDescriptors (const std::vector<Descriptor>& query, const std::vector<Keypoint>& query_keypoints,
+                           const std::vector<Descriptor>& train, const std::vector<Keypoint>& train_keypoints,
+                           DescriptorKind kind, int radius, std::vector<Match>& matches) {
+        int (*distance) (const Descriptor&, const Descriptor&) = kind == SAD ? sadDistance : hammingDistance;
+        matches.resize(query.size());
+
+        /* Train indices sorted by grid cell, cell c holds indices [cell_start[c], cell_start[c + 1]) */
+        int cells_x = 1, cells_y = 1;
+        std::vector<int> cell_start, indices;
+
+        if (radius > 0) {
+            for (size_t t = 0; t < train_keypoints.size(); t++) {
+                cells_x = std::max(cells_x, train_keypoints[t].x / radius + 1);
+                cells_y = std::max(cells_y, train_keypoints[t].y / radius + 1);
+            }
+
+            cell_start.assign(cells_x * cells_y + 1, 0);
+            indices.resize(train_keypoints.size());
+
+            for (size_t t = 0; t < train_keypoints.size(); t++)
+                cell_start[(train_keypoints[t].y / radius) * cells_x + train_keypoints[t].x / radius + 1]++;
+            for (int c = 0; c < cells_x * cells_y; c++)
+                cell_start[c + 1] += cell_start[c];
+
+            std::vector<int> next (cell_start.begin(), cell_start.end() - 1);
+            for (size_t t = 0; t < train_keypoints.size(); t++)
+                indices[next[(train_keypoints[t].y / radius) * cells_x + train_keypoints[t].x / radius]++] = t;
+        }
+
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int q = 0; q < (int)query.size(); q++) {
+            Match best = { -1, INT32_MAX };
+
+            if (radius <= 0) {
+                for (int t = 0; t < (int)train.size(); t++) {
+                    int d = distance(query[q], train[t]);
+                    if (d < best.distance) {
+                        best.train = t;
+                        best.distance = d;
+                    }
+                }
+
+                matches[q] = best;
+                continue;
+            }
+
+            const Keypoint& point = query_keypoints[q];
+            int x0 = std::max(point.x - radius, 0) / radius, x1 = std::min((point.x + radius) / radius, cells_x - 1);
+            int y0 = std::max(point.y - radius, 0) / radius, y1 = std::min((point.y + radius) / radius, cells_y - 1);
+
+            for (int cy = y0; cy <= y1; cy++)
+                for (int cx = x0; cx <= x1; cx++) {
+                    int cell = cy * cells_x + cx;
+
+                    for (int i = cell_start[cell]; i < cell_start[cell + 1]; i++) {
+                        int t = indices[i];
+                        if (abs(train_keypoints[t].x - point.x) > radius || abs(train_keypoints[t].y - point.y) > radius)
+                            continue;
+
+                        /* Cells are visited out of index order, lower index wins ties */
+                        int d = distance(query[q], train[t]);
+                        if (d < best.distance || (d == best.distance && t < best.train)) {
+                            best.train = t;
+                            best.distance = d;
+                        }
+                    }
+                }
+
+            matches[q] = best;
+        }
+    }
+
+    Matcher::Matcher (oclw::Controller* controller, oclw::Program* program)
+        : _controller (controller),
+          _describe (program->createKernel("describe")),
+          _match (program->createKernel("match_descriptors")),
+          _query (controller->createMemoryBuffer()),
+          _query_keypoints (controller->createMemoryBuffer()),
+          _train (controller->createMemoryBuffer()),
+          _train_keypoints (controller->createMemoryBuffer()),
+          _matches (controller->createMemoryBuffer()),
+          _group_size (std::min((size_t)64, _match->workGroupSize())) {}
+
+    void Matcher::describe (oclw::MemoryBuffer& image, unsigned int width, unsigned int height, const std::vector<Keypoint>& keypoints,
+                            DescriptorKind kind, std::vector<Descriptor>& descriptors) {
+        descriptors.resize(keypoints.size());
+        if (keypoints.empty())
+            return;
+
+        _query_keypoints->reserve(oclw::MemoryBuffer::READ_WRITE, keypoints.size() * sizeof(Keypoint));
+        _query->reserve(oclw::MemoryBuffer::READ_WRITE, keypoints.size() * sizeof(Descriptor));
+
+        _query_keypoints->writeDataAsync(&keypoints[0], keypoints.size() * sizeof(Keypoint));
+        _describe->launch(oclw::Kernel::NDRange::range1D(keypoints.size()), image, (int)width, (int)height,
+                          *_query_keypoints, (int)keypoints.size(), (int)(kind == HAMMING), *_query);
+
+        _query->readData(&descriptors[0], descriptors.size() * sizeof(Descriptor));
+    }
+
+    void Matcher::match (const std::vector<Descriptor>& query, const std::vector<Keypoint>& query_keypoints,
+                         const std::vector<Descriptor>& train, const std::vector<Keypoint>& train_keypoints,
+                         DescriptorKind kind, int radius, std::vector<Match>& matches) {
+        Match none = { -1, INT32_MAX };
+        matches.assign(query.size(), none);
+
+        if (query.empty() || train.empty())
+            return;
+
+        _query->reserve(oclw::MemoryBuffer::READ_WRITE, query.size() * sizeof(Descriptor));
+        _query_keypoints->reserve(oclw::MemoryBuffer::READ_WRITE, query.size() * sizeof(Keypoint));
+        _train->reserve(oclw::MemoryBuffer::READ_WRITE, train.size() * sizeof(Descriptor));
+        _train_keypoints->reserve(oclw::MemoryBuffer::READ_WRITE, train.size() * sizeof(Keypoint));
+        _matches->reserve(oclw::MemoryBuffer::READ_WRITE, query.size() * sizeof(Match));
+
+        _query->writeDataAsync(&query[0], query.size() * sizeof(Descriptor));
+        _query_keypoints->writeDataAsync(&query_keypoints[0], query.size() * sizeof(Keypoint));
+        _train->writeDataAsync(&train[0], train.size() * sizeof(Descriptor));
+        _train_keypoints->writeDataAsync(&train_keypoints[0], train.size() * sizeof(Keypoint));
+
+        /* Each work item loads one train descriptor of the tile */
+        size_t global_size = (query.size() + _group_size - 1) / _group_size * _group_size;
+        _match->launch(oclw::Kernel::NDRange::range1D(global_size), oclw::Kernel::NDRange::range1D(_group_size),
+                       *_query, *_query_keypoints, (int)query.size(), *_train, *_train_keypoints, (int)train.size(),
+                       (int)(kind == HAMMING), radius, *_matches,
+                       oclw::Local(_group_size * sizeof(Descriptor)), oclw::Local(_group_size * 2 * sizeof(cl_int)));
+
+        _matches->readData(&matches[0], matches.size() * sizeof(Match));
+    }
+}
@@ -0,0 +1,113 @@
+//
+//  Matcher.h
+//  Seminar
+//
+
+#ifndef Seminar_Matcher_h
+#define Seminar_Matcher_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "oclw/Controller.h"
+#include "oclw/Program.h"
+#include "oclw/Kernel.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Handle.h"
+
+#include "FeatureExtractor.h"
+
+namespace seminar {
+
+    /*! Kind of descriptor and the distance used to compare them.
+     */
+    enum DescriptorKind {
+        SAD,        /*!< 32 gray values sampled around the keypoint, sum of absolute differences. */
+        HAMMING     /*!< 256 comparisons of pairs of the same samples, Hamming distance. */
+    };
+
+    /*! Patch descriptor of a keypoint. Both kinds take 32 bytes.
+     */
+    struct Descriptor {
+        uint8_t data[32];
+    };
+
+    /*! Nearest train descriptor of a query descriptor.
+     */
+    struct Match {
+        int32_t train;      /*!< Index of the train keypoint, -1 if none is within search radius. */
+        int32_t distance;   /*!< Distance of descriptors, INT32_MAX if there is no match. */
+    };
+
+    /*! Computes descriptors of keypoints of 8-bit gray image. Samples are taken from
+     *  9x9 patch around each keypoint, pixels outside of the image are repeated border pixels.
+     */
+    void describe (const uint8_t* image, unsigned int width, unsigned int height, const std::vector<Keypoint>& keypoints,
+                   DescriptorKind kind, std::vector<Descriptor>& descriptors);
+
+    /*! Finds nearest train descriptor for each query descriptor.
+     *
+     *  If radius is positive, only train keypoints that differ from the query
+     *  keypoint by at most radius pixels in each direction are considered, and
+     *  they are found through a grid of radius x radius buckets. Otherwise
+     *  all train descriptors are compared (brute force). Of equally distant
+     *  train descriptors, the one with the lowest index wins.
+     *
+     *  \param matches Receives one match per query descriptor.
+     */
+    void matchDescriptors (const std::vector<Descriptor>& query, const std::vector<Keypoint>& query_keypoints,
+                           const std::vector<Descriptor>& train, const std::vector<Keypoint>& train_keypoints,
+                           DescriptorKind kind, int radius, std::vector<Match>& matches);
+
+    /*! Computes and matches descriptors on the OpenCL device, with results
+     *  identical to seminar::describe and seminar::matchDescriptors.
+     *
+     *  Matching is brute force: a work group loads a tile of train descriptors
+     *  into local memory, and each of its work items compares its query
+     *  descriptor against the whole tile. Search radius only filters the
+     *  candidates.
+     *
+     *  \code
+     *  seminar::Matcher matcher (controller, program);
+     *  matcher.describe(*frame_gpu, width, height, keypoints, seminar::HAMMING, descriptors);
+     *  matcher.match(descriptors, keypoints, previous_descriptors, previous_keypoints, seminar::HAMMING, 0, matches);
+     *  \endcode
+     */
+    class Matcher {
+    private:
+        oclw::Controller* _controller;
+
+        oclw::Handle<oclw::Kernel> _describe;
+        oclw::Handle<oclw::Kernel> _match;
+
+        oclw::Handle<oclw::MemoryBuffer> _query;
+        oclw::Handle<oclw::MemoryBuffer> _query_keypoints;
+        oclw::Handle<oclw::MemoryBuffer> _train;
+        oclw::Handle<oclw::MemoryBuffer> _train_keypoints;
+        oclw::Handle<oclw::MemoryBuffer> _matches;
+
+        size_t _group_size;
+
+        Matcher (const Matcher&);
+        Matcher& operator= (const Matcher&);
+
+    public:
+        /*! \param program Program built from cl_program.cl. Matcher creates its own kernels.
+         */
+        Matcher (oclw::Controller* controller, oclw::Program* program);
+
+        /*! Same as seminar::describe, for image on the device. Blocks until descriptors are read.
+         */
+        void describe (oclw::MemoryBuffer& image, unsigned int width, unsigned int height, const std::vector<Keypoint>& keypoints,
+                       DescriptorKind kind, std::vector<Descriptor>& descriptors);
+
+        /*! Same as seminar::matchDescriptors. Blocks until matches are read.
+         */
+        void match (const std::vector<Descriptor>& query, const std::vector<Keypoint>& query_keypoints,
+                    const std::vector<Descriptor>& train, const std::vector<Keypoint>& train_keypoints,
+                    DescriptorKind kind, int radius, std::vector<Match>& matches);
+    };
+}
+
+#endif
@@ -0,0 +1,334 @@
+//
+//  Pipeline.cpp
+//  Seminar
+//
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <deque>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "oclw/Controller.h"
+#include "oclw/MemoryBuffer.h"
+#include "oclw/Kernel.h"
+#include "oclw/Exception.h"
+#include "oclw/Handle.h"
+#include "oclw/CommandList.h"
+#include "oclw/Trace.h"
+
+#include "Pipeline.h"
+#include "BoundedQueue.h"
+#include "ImageIO.h"
+
+namespace seminar {
+
+    /*! Image travelling through the pipeline.
+     */
+    struct Frame {
+        std::string output_path;
+        unsigned int width, height;                 /* Size of original image */
+        unsigned int padded_width, padded_height;   /* Size of input array */
+        unsigned int out_width, out_height;         /* Size of output array */
+        uint8_t* input;
+        uint8_t* output;
+
+        Frame () : input (NULL), output (NULL) {}
+
+        ~Frame () {
+            free(input);
+            free(output);
+        }
+    };
+
+    BatchOptions::BatchOptions () {
+        unsigned int cores = std::thread::hardware_concurrency();
+        if (cores == 0)
+            cores = 2;
+
+        decode_threads = std::max(1u, cores / 2);
+        encode_threads = std::max(1u, cores / 2);
+        device_slots = 3;
+        queue_capacity = 2 * device_slots;
+    }
+
+    BatchPipeline::BatchPipeline (oclw::Controller* controller, oclw::Kernel* cnv_kernel, oclw::MemoryBuffer* conv_kernel,
+                                  int kernel_size, unsigned int local_work_size_x, unsigned int local_work_size_y,
+                                  const BatchOptions& options)
+        : _controller (controller), _kernel (cnv_kernel), _conv_kernel (conv_kernel), _kernel_size (kernel_size),
+          _local_work_size_x (local_work_size_x), _local_work_size_y (local_work_size_y), _options (options) {
+    }
+
+    Frame* BatchPipeline::decode (const std::string& input_path, const std::string& output_dir) {
+        oclw::TraceSpan span ("decode", "app");
+        PngReader png_image (input_path.c_str());
+
+        Frame* frame = new Frame;
+        frame->width = png_image.width();
+        frame->height = png_image.height();
+
+        /* Same padding as in single image mode */
+        unsigned int width = frame->width, height = frame->height;
+        height += (height % _local_work_size_y != 0) ? _local_work_size_y - height % _local_work_size_y : 0;
+        width += (width % _local_work_size_x != 0) ? _local_work_size_x - width % _local_work_size_x : 0;
+        frame->out_width = width;
+        frame->out_height = height;
+        frame->padded_width = width + _kernel_size - 1;
+        frame->padded_height = height + _kernel_size - 1;
+
+        try {
+            frame->input = allocateAligned(frame->padded_width * frame->padded_height);
+            frame->output = allocateAligned(frame->out_width * frame->out_height);
+            png_image.read(frame->input, frame->padded_width, frame->padded_height);
+        } catch (...) {
+            delete frame;
+            throw;
+        }
+
+        size_t name_start = input_path.find_last_of('/');
+        frame->output_path = output_dir + "/" + input_path.substr(name_start == std::string::npos ? 0 : name_start + 1);
+
+        return frame;
+    }
+
+    void BatchPipeline::encode (Frame* frame) {
+        oclw::TraceSpan span ("encode", "app");
+        writePng(frame->output_path.c_str(), frame->output, frame->out_width, frame->width, frame->height);
+    }
+
+    unsigned int BatchPipeline::runSequential (const std::vector<std::string>& inputs, const std::string& output_dir) {
+        unsigned int processed = 0;
+
+        oclw::Handle<oclw::MemoryBuffer> in_gpu (_controller->createMemoryBuffer());
+        oclw::Handle<oclw::MemoryBuffer> out_gpu (_controller->createMemoryBuffer());
+
+        /* Frames of the same size repeat the same commands, only host memory differs */
+        oclw::CommandList commands (_controller);
+        oclw::CommandList::Pointer input = commands.pointer();
+        oclw::CommandList::Pointer output = commands.pointer();
+        unsigned int recorded_width = 0, recorded_height = 0;
+
+        for (size_t i = 0; i < inputs.size(); i++) {
+            Frame* frame;
+
+            try {
+                frame = decode(inputs[i], output_dir);
+            } catch (std::runtime_error e) {
+                std::cout << "Skipping " << inputs[i] << ": " << e.what() << std::endl;
+                continue;
+            }
+
+            size_t in_size = frame->padded_width * frame->padded_height;
+            size_t out_size = frame->out_width * frame->out_height;
+
+            if (frame->padded_width != recorded_width || frame->padded_height != recorded_height) {
+                in_gpu->reserve(oclw::MemoryBuffer::READ, in_size);
+                out_gpu->reserve(oclw::MemoryBuffer::WRITE, out_size);
+
+                int in_width = frame->padded_width;
+                int out_width = frame->out_width;
+                int out_height = frame->out_height;
+
+                commands.clear();
+                commands.write(*in_gpu, input, in_size);
+                commands.launch(_kernel, oclw::Kernel::NDRange::range2D(out_width, out_height),
+                                oclw::Kernel::NDRange::range2D(_local_work_size_x, _local_work_size_y),
+                                *in_gpu, *out_gpu, *_conv_kernel, in_width, out_width, out_height, _kernel_size);
+                commands.read(*out_gpu, output, out_size);
+
+                recorded_width = frame->padded_width;
+                recorded_height = frame->padded_height;
+            }
+
+            commands.set(input, frame->input);
+            commands.set(output, frame->output);
+            commands.replay();
+            _controller->finish();
+
+            encode(frame);
+            delete frame;
+            processed++;
+        }
+
+        return processed;
+    }
+
+    /* Set of device buffers one frame occupies while being processed.
+     */
+    struct DeviceSlot {
+        oclw::Handle<oclw::MemoryBuffer> input;
+        oclw::Handle<oclw::MemoryBuffer> output;
+    };
+
+    /* Frame whose readback was enqueued but is not necessarily completed.
+     */
+    struct InFlight {
+        Frame* frame;
+        cl_event done;
+    };
+
+    void BatchPipeline::deviceStage (BoundedQueue<Frame*>& decoded, BoundedQueue<Frame*>& encoded) {
+        std::vector<DeviceSlot> slots (_options.device_slots);
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].input.reset(_controller->createMemoryBuffer());
+            slots[i].output.reset(_controller->createMemoryBuffer());
+        }
+
+        std::deque<InFlight> in_flight;
+        unsigned int next_slot = 0;
+        Frame* frame = NULL;
+
+        try {
+            while (decoded.pop(frame)) {
+                /* All slots busy, wait for the oldest frame. Its slot is the one we use next. */
+                if (in_flight.size() == slots.size()) {
+                    oclw::TraceSpan span ("wait for frame", "app");
+                    clWaitForEvents(1, &in_flight.front().done);
+                    clReleaseEvent(in_flight.front().done);
+                    encoded.push(in_flight.front().frame);
+                    in_flight.pop_front();
+                }
+
+                DeviceSlot& slot = slots[next_slot];
+                next_slot = (next_slot + 1) % slots.size();
+
+                size_t in_size = frame->padded_width * frame->padded_height;
+                size_t out_size = frame->out_width * frame->out_height;
+
+                slot.input->reserve(oclw::MemoryBuffer::READ, in_size);
+                slot.output->reserve(oclw::MemoryBuffer::WRITE, out_size);
+
+                int in_width = frame->padded_width;
+                int out_width = frame->out_width;
+                int out_height = frame->out_height;
+
+                InFlight entry;
+                entry.frame = frame;
+
+                /* Arguments are captured at enqueue, so one kernel object serves all slots */
+                slot.input->writeDataAsync(frame->input, in_size);
+
+                _kernel->launch(oclw::Kernel::NDRange::range2D(out_width, out_height),
+                                oclw::Kernel::NDRange::range2D(_local_work_size_x, _local_work_size_y),
+                                *slot.input, *slot.output, *_conv_kernel, in_width, out_width, out_height, _kernel_size);
+
+                slot.output->readDataAsync(frame->output, out_size, &entry.done);
+                _controller->flush();
+
+                in_flight.push_back(entry);
+            }
+        } catch (oclw::Exception& e) {
+            /* Frames still in flight own host memory the device may write to */
+            _controller->finish();
+            for (size_t i = 0; i < in_flight.size(); i++) {
+                clReleaseEvent(in_flight[i].done);
+                delete in_flight[i].frame;
+            }
+            delete frame;
+            throw;
+        }
+
+        while (!in_flight.empty()) {
+            clWaitForEvents(1, &in_flight.front().done);
+            clReleaseEvent(in_flight.front().done);
+            encoded.push(in_flight.front().frame);
+            in_flight.pop_front();
+        }
+    }
+
+    unsigned int BatchPipeline::runPipelined (const std::vector<std::string>& inputs, const std::string& output_dir) {
+        BoundedQueue<std::string> paths (inputs.size() + 1);
+        BoundedQueue<Frame*> decoded (_options.queue_capacity);
+        BoundedQueue<Frame*> encoded (_options.queue_capacity);
+
+        for (size_t i = 0; i < inputs.size(); i++)
+            paths.push(inputs[i]);
+        paths.close();
+
+        std::vector<unsigned int> encoded_counts (_options.encode_threads, 0);
+        std::vector<std::thread> decoders, encoders;
+
+        for (unsigned int t = 0; t < _options.encode_threads; t++)
+            encoders.push_back(std::thread([this, &encoded, &encoded_counts, t] () {
+                Frame* frame;
+                while (encoded.pop(frame)) {
+                    try {
+                        encode(frame);
+                        encoded_counts[t]++;
+                    } catch (std::runtime_error e) {
+                        std::cout << "Could not write " << frame->output_path << ": " << e.what() << std::endl;
+                    }
+                    delete frame;
+                }
+            }));
+
+        for (unsigned int t = 0; t < _options.decode_threads; t++)
+            decoders.push_back(std::thread([this, &paths, &decoded, &output_dir] () {
+                std::string path;
+                while (paths.pop(path)) {
+                    try {
+                        Frame* frame = decode(path, output_dir);
+                        if (!decoded.push(frame))
+                            delete frame;
+                    } catch (std::runtime_error e) {
+                        std::cout << "Skipping " << path << ": " << e.what() << std::endl;
+                    }
+                }
+            }));
+
+        std::thread device ([this, &decoded, &encoded] () {
+            try {
+                deviceStage(decoded, encoded);
+            } catch (oclw::Exception e) {
+                std::cout << "OpenCL device error: " << e.what() << std::endl;
+
+                /* Unblock decoders and drop what they already produced */
+                decoded.close();
+                Frame* frame;
+                while (decoded.pop(frame))
+                    delete frame;
+            }
+        });
+
+        for (size_t i = 0; i < decoders.size(); i++)
+            decoders[i].join();
+        decoded.close();
+
+        device.join();
+        encoded.close();
+
+        for (size_t i = 0; i < encoders.size(); i++)
+            encoders[i].join();
+
+        unsigned int processed = 0;
+        for (size_t i = 0; i < encoded_counts.size(); i++)
+            processed += encoded_counts[i];
+
+        return processed;
+    }
+
+    std::vector<std::string> listPngFiles (const char* dir_path) {
+        std::vector<std::string> files;
+
+        DIR* dir = opendir(dir_path);
+        if (dir == NULL)
+            return files;
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            size_t length = strlen(entry->d_name);
+            if (length > 4 && strcasecmp(entry->d_name + length - 4, ".png") == 0)
+                files.push_back(std::string(dir_path) + "/" + entry->d_name);
+        }
+
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+
+        return files;
+    }
+}
@@ -0,0 +1,93 @@
+//
+//  Pipeline.h
+//  Seminar
+//
+
+#ifndef Seminar_Pipeline_h
+#define Seminar_Pipeline_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace oclw {
+    class Controller;
+    class Kernel;
+    class MemoryBuffer;
+}
+
+namespace seminar {
+    struct Frame;
+    template <typename T> class BoundedQueue;
+
+    /*! Tunables of the batch pipeline.
+     */
+    struct BatchOptions {
+        unsigned int decode_threads;    /*!< Number of threads decoding PNG files. */
+        unsigned int encode_threads;    /*!< Number of threads encoding PNG files. */
+        unsigned int device_slots;      /*!< Number of device buffer sets (2 = double, 3 = triple buffering). */
+        unsigned int queue_capacity;    /*!< Capacity of queues between stages. */
+
+        /*! Derives thread counts from the number of available cores.
+         */
+        BatchOptions ();
+    };
+
+    /*! Applies convolve2d (blob filter) to many PNG images.
+     *
+     *  Sequential mode processes images strictly one after another, same as
+     *  single image mode. Pipelined mode overlaps the stages:
+     *
+     *  decode pool -> [queue] -> device thread -> [queue] -> encode pool
+     *
+     *  Device thread cycles through device_slots sets of device buffers. Upload,
+     *  kernel and readback of a frame are only enqueued, so the device works on
+     *  one frame while the host decodes and encodes others. A slot is reused only
+     *  after readback of the frame that previously used it has completed.
+     *  Bounded queues make a fast stage wait for a slow one instead of buffering
+     *  the whole directory in memory.
+     */
+    class BatchPipeline {
+    private:
+        oclw::Controller* _controller;
+        oclw::Kernel* _kernel;
+        oclw::MemoryBuffer* _conv_kernel;
+        int _kernel_size;
+        unsigned int _local_work_size_x;
+        unsigned int _local_work_size_y;
+        BatchOptions _options;
+
+        Frame* decode (const std::string& input_path, const std::string& output_dir);
+        void encode (Frame* frame);
+        void deviceStage (BoundedQueue<Frame*>& decoded, BoundedQueue<Frame*>& encoded);
+
+    public:
+        /*! \param cnv_kernel convolve2d kernel object.
+         *  \param conv_kernel Convolution kernel already uploaded to the device.
+         *  \param kernel_size Width and height of convolution kernel.
+         *  \param local_work_size_x Local work size, images are padded to its multiple.
+         *  \param local_work_size_y Local work size, images are padded to its multiple.
+         */
+        BatchPipeline (oclw::Controller* controller, oclw::Kernel* cnv_kernel, oclw::MemoryBuffer* conv_kernel,
+                       int kernel_size, unsigned int local_work_size_x, unsigned int local_work_size_y,
+                       const BatchOptions& options = BatchOptions());
+
+        /*! Processes images one after another with blocking transfers.
+         *
+         *  \return Number of successfully processed images.
+         */
+        unsigned int runSequential (const std::vector<std::string>& inputs, const std::string& output_dir);
+
+        /*! Processes images with overlapped decode, device and encode stages.
+         *
+         *  \return Number of successfully processed images.
+         */
+        unsigned int runPipelined (const std::vector<std::string>& inputs, const std::string& output_dir);
+    };
+
+    /*! Returns sorted paths of all PNG files in a directory.
+     */
+    std::vector<std::string> listPngFiles (const char* dir_path);
+}
+
+#endif
@@ -6,53 +6,56 @@
 //
 
 #include <iostream>
-#include <sys/time.h>
+#include <vector>
+#include <algorithm>
 #include <stdlib.h>
-
-#include <png++/png.hpp>
+#include <string.h>
 
 #include "oclw/Controller.h"
 #include "oclw/MemoryBuffer.h"
 #include "oclw/Program.h"
 #include "oclw/Kernel.h"
 #include "oclw/Exception.h"
+#include "oclw/Handle.h"
+#include "oclw/PingPong.h"
+#include "oclw/Image.h"
 
 #include "Filters.h"
+#include "Pipeline.h"
+#include "ImageIO.h"
+#include "BandProcessor.h"
+#include "KernelPlanner.h"
+#include "ChannelProcessor.h"
+#include "FeatureExtractor.h"
+#include "Matcher.h"
+#include "IntegralImage.h"
+#include "WorkerPool.h"
+#include "Clock.h"
 
-/*! Simple timer class. Use tick() and tock() 
- *  methods to measure time.
- */
-class Clock {
-private:
-    timeval _start_time;
-    
-public:
-    /*! Starts clock.
-     */
-    void tick() {
-        gettimeofday(&_start_time, NULL);
-    }
-    
-    /*! Gets elapsed time since start or since last call of itself.
-     *  \param ret Elapsed time since last call to tick().
-     */
-    void tock(double& ret) {
-        timeval end_time;
-        long seconds, useconds;
-        
-        gettimeofday(&end_time, NULL);
-        seconds = end_time.tv_sec - _start_time.tv_sec;
-        useconds = end_time.tv_usec - _start_time.tv_usec;
-        
-        gettimeofday(&_start_time, NULL);
-        
-        ret = seconds * 1000.0 + useconds / 1000.0;
-    }
-};
 
+/* Applies convolution to all PNG images in a directory, sequentially and pipelined */
+int run_batch (oclw::Controller* gpu_controller, oclw::Kernel* cnv_task_kernel, const int8_t* kernel, int kernel_size,
+               unsigned int local_work_size_x, unsigned int local_work_size_y, const char* input_dir, const char* output_dir);
+
+/* Applies convolution to memory mapped raw/PGM image and writes result to memory mapped file */
+int run_mapped (oclw::Controller* gpu_controller, oclw::Kernel* cnv_task_kernel, oclw::Kernel* nms_task_kernel,
+                seminar::KernelPlanner* planner, const int8_t* kernel, int kernel_size, const char* input_path, const char* output_path, unsigned int width, unsigned int height);
 
-/* Converts uint8 array to png image object */
-png::image<png::gray_pixel> uint8_to_png (uint8_t* image, unsigned int width, unsigned int height);
+/* Applies NMS and convolution to every channel of a color or 16-bit PNG image */
+int run_color (oclw::Controller* gpu_controller, oclw::Program* gpu_program, const int8_t* kernel, int kernel_size,
+               const char* input_path, unsigned int nms_n);
+
+
+/* Waits for the program build started at initialization and creates kernels */
+bool create_kernels (oclw::Controller* gpu_controller, oclw::Program* gpu_program, oclw::Kernel*& nms_task_kernel,
+                     oclw::Kernel*& cnv_task_kernel, oclw::Kernel*& smooth_task_kernel, seminar::KernelPlanner*& planner);
+
+#ifdef SEMINAR_EMBEDDED_PROGRAM
+/* Contents of src/cl_program.cl, generated by makefile */
+static const char* program_source =
+#include "cl_program.cl.inc"
+;
+#endif
 
 
 /* Entry point */
@@ -64,11 +67,19 @@ int main (int argc, const char * argv[]) {
     
     oclw::Controller* gpu_controller;
     oclw::Program* gpu_program;
-    oclw::Kernel* nms_task_kernel, * cnv_task_kernel;
+    oclw::Kernel* nms_task_kernel, * cnv_task_kernel, * smooth_task_kernel;
+    seminar::KernelPlanner* planner;
     
     /* Check args */
-    if (argc != 3) {
+    bool batch = argc == 4 && strcmp(argv[1], "-batch") == 0;
+    bool mapped = (argc == 4 || argc == 6) && strcmp(argv[1], "-mapped") == 0;
+    bool color = argc == 4 && strcmp(argv[1], "-color") == 0;
+    
+    if (argc != 3 && !batch && !mapped && !color) {
         std::cout << "Usage: " << argv[0] << " png_image_path nms_block_size" << std::endl;
+        std::cout << "       " << argv[0] << " -batch input_dir output_dir" << std::endl;
+        std::cout << "       " << argv[0] << " -mapped input.pgm|raw output.pgm|raw [raw_width raw_height]" << std::endl;
+        std::cout << "       " << argv[0] << " -color png_image_path nms_block_size" << std::endl;
         return -1;
     }
     
@@ -78,9 +89,13 @@ int main (int argc, const char * argv[]) {
         gpu_controller = oclw::Controller::shared();
         gpu_controller->getInfo().print();
         gpu_program = gpu_controller->createProgramObject();
-        gpu_program->compileFromSourceFile("src/cl_program.cl");
-        nms_task_kernel = gpu_program->createKernel("nms");
-        cnv_task_kernel = gpu_program->createKernel("convolve2d");
+        
+        /* Program is built in the background while input is loaded, kernels wait for it */
+#ifdef SEMINAR_EMBEDDED_PROGRAM
+        gpu_program->compileFromSourceStringAsync(program_source);
+#else
+        gpu_program->compileFromSourceFileAsync("src/cl_program.cl");
+#endif
     } catch (oclw::Exception e) {
         std::cout << "OpenCL initialization error: " << e.what() << std::endl;
         return 0;
@@ -89,27 +104,41 @@ int main (int argc, const char * argv[]) {
 #pragma mark Data loading
     /* Kernel used for convolution 2D */
     int kernel_size = 5; /* Width and height */
-    uint8_t kernel[25] __attribute__ ((aligned (16))) = { 
+    int8_t kernel[25] __attribute__ ((aligned (16))) = { 
         -1, -1, -1, -1, -1,
         -1,  1,  1,  1, -1,
         -1,  1,  8,  1, -1,
         -1,  1,  1,  1, -1,
         -1, -1, -1, -1, -1 };
     
-    /* Load image into uint8 array (grayscale) */
-    png::image<png::gray_pixel> test_img_png;
+    unsigned int local_work_size_x = 15;
+    unsigned int local_work_size_y = 15;
+    
+    if ((batch || mapped) && !create_kernels(gpu_controller, gpu_program, nms_task_kernel, cnv_task_kernel, smooth_task_kernel, planner))
+        return 0;
+    
+    if (batch)
+        return run_batch(gpu_controller, cnv_task_kernel, kernel, kernel_size,
+                         local_work_size_x, local_work_size_y, argv[2], argv[3]);
+    
+    if (mapped)
+        return run_mapped(gpu_controller, cnv_task_kernel, nms_task_kernel, planner, kernel, kernel_size, argv[2], argv[3],
+                          argc == 6 ? atoi(argv[4]) : 0, argc == 6 ? atoi(argv[5]) : 0);
+    
+    if (color)
+        return run_color(gpu_controller, gpu_program, kernel, kernel_size, argv[2], atoi(argv[3]));
+    
+    /* Read image header, pixels are decoded later directly into the padded array */
+    seminar::PngReader* test_img_png;
     try {
-        test_img_png = png::image<png::gray_pixel>(argv[1]);
-    } catch (png::std_error e) {
+        test_img_png = new seminar::PngReader(argv[1]);
+    } catch (std::runtime_error e) {
         std::cout << "Error: " << e.what() << std::endl;
         return -1;
     }
     
-    unsigned int height = (unsigned int)test_img_png.get_height();
-    unsigned int width = (unsigned int)test_img_png.get_width();
-    
-    unsigned int local_work_size_x = 15;
-    unsigned int local_work_size_y = 15;
+    unsigned int height = test_img_png->height();
+    unsigned int width = test_img_png->width();
     
     /* Increase image size to be divisible by local_work_size */
     height += (height % local_work_size_y != 0) ? local_work_size_y - height % local_work_size_y : 0;
@@ -117,44 +146,72 @@ int main (int argc, const char * argv[]) {
     height += kernel_size - 1;
     width += kernel_size - 1;
     
-    uint8_t* test_img __attribute__ ((aligned (16))) = new uint8_t[width * height];
-    uint8_t* out_img __attribute__ ((aligned (16))) = new uint8_t[width * height];
+    /* Page aligned, pinned if OpenCL device supports it */
+    seminar::HostImageBuffer test_img_buffer (width * height, gpu_controller);
+    seminar::HostImageBuffer out_img_buffer (width * height, gpu_controller);
+    uint8_t* test_img = test_img_buffer.data();
+    uint8_t* out_img = out_img_buffer.data();
     
-    /* Convert image to uint8 array and init out_img array to zeroes */
-    for (size_t i = 0; i < height; i++)
-        for (size_t j = 0; j < width; j++) {
-            try {
-                test_img[i*width + j] = test_img_png.get_pixel(j, i);
-            } catch (std::out_of_range e) {
-                test_img[i*width + j] = 0;
-            }
-            out_img[i*width + j] = 0;
-        }
+    /* Decode image into uint8 array (grayscale) and init out_img array to zeroes */
+    clock.tick();
+    
+    try {
+        test_img_png->read(test_img, width, height);
+    } catch (std::runtime_error e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    delete test_img_png;
+    
+    memset(out_img, 0, width*height);
+    
+    clock.tock(cpu_time);
+    std::cout << std::endl << "Image loaded in " << cpu_time << " ms"
+              << (test_img_buffer.pinned() ? " (pinned memory)" : "") << std::endl;
     
-    /* Create memory objects on GPU and transfer test_img, out_img and kernel to them */
+    /* Build ran while the image was loading, so this should not wait for long */
     clock.tick();
+    if (!create_kernels(gpu_controller, gpu_program, nms_task_kernel, cnv_task_kernel, smooth_task_kernel, planner))
+        return 0;
+    clock.tock(gpu_time);
+    std::cout << "Waited " << gpu_time << " ms for the OpenCL program build" << std::endl;
     
-    oclw::MemoryBuffer* test_img_gpu;
-    oclw::MemoryBuffer* out_img_gpu;
-    oclw::MemoryBuffer* kernel_gpu;
+    /* Images that do not fit into device memory are processed in bands */
+    seminar::BandProcessor band_processor (gpu_controller, cnv_task_kernel, nms_task_kernel);
+    bool banded = band_processor.needed(width*height, width*height);
     
-    try {
-        test_img_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*width*height);
-        test_img_gpu->writeData(test_img, sizeof(uint8_t)*width*height);
+    oclw::MemoryBuffer* test_img_gpu = NULL;
+    oclw::MemoryBuffer* kernel_gpu = NULL;
+    
+    /* Results of the OpenCL device, read back only when they are written to a file */
+    oclw::Image* out_img_gpu = NULL;
+    const uint8_t* gpu_result = out_img;
+    
+    if (banded) {
+        std::cout << std::endl << "Image exceeds OpenCL device memory, processing in bands" << std::endl;
+    } else {
+        /* Create memory objects on GPU and transfer test_img and kernel to them */
+        clock.tick();
         
-        out_img_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, sizeof(uint8_t)*width*height);
-        out_img_gpu->writeData(out_img, sizeof(uint8_t)*width*height);
+        try {
+            test_img_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*width*height);
+            test_img_gpu->writeData(test_img, sizeof(uint8_t)*width*height);
+            
+            /* Cleared on the device, nothing is transferred */
+            out_img_gpu = new oclw::Image(gpu_controller, width, height);
+            out_img_gpu->clear();
+            
+            kernel_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*kernel_size*kernel_size);
+            kernel_gpu->writeData(kernel, sizeof(uint8_t)*kernel_size*kernel_size);
+        } catch (oclw::Exception e) {
+            std::cout << "GPU memory initialization error: " << e.what() << std::endl;
+            return 0;
+        }
         
-        kernel_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*kernel_size*kernel_size);
-        kernel_gpu->writeData(kernel, sizeof(uint8_t)*kernel_size*kernel_size);
-    } catch (oclw::Exception e) {
-        std::cout << "GPU memory initialization error: " << e.what() << std::endl;
-        return 0;
+        clock.tock(gpu_time);
+        std::cout << std::endl << "Data transfer to the OpenCL device memory completed in " << gpu_time << " ms" << std::endl;
     }
     
-    clock.tock(gpu_time);
-    std::cout << std::endl << "Data transfer to the OpenCL device memory completed in " << gpu_time << " ms" << std::endl;
-    
 #pragma mark Testing: Non-Maximum Suppression
     int n;  /* NMS block size */
     sscanf(argv[2], "%d", &n);
@@ -167,28 +224,96 @@ int main (int argc, const char * argv[]) {
     seminar::nsm(test_img, width, height, out_img, n);
     clock.tock(cpu_time);
     
-    uint8_to_png(out_img, width, height).write("resources/test_image_nms_cpu.png");
+    seminar::writePng("resources/test_image_nms_cpu.png", out_img, width, width, height);
     
     /* Perform calculation on GPU */
-    nms_task_kernel->setArgument(0, *test_img_gpu);
-    nms_task_kernel->setArgument(1, *out_img_gpu);
-    nms_task_kernel->setArgument(2, sizeof(int), &width);
-    nms_task_kernel->setArgument(3, sizeof(int), &height);
-    nms_task_kernel->setArgument(4, sizeof(int), &n);
-    
-    clock.tick();
-    nms_task_kernel->execute(oclw::Kernel::NDRange::range2D((width - 2*n)/(n+1)+1, (height - 2*n)/(n+1)+1));
-   
-    clock.tock(gpu_time);
+    if (banded) {
+        /* Includes transfers of all bands */
+        memset(out_img, 0, width*height);
+        
+        clock.tick();
+        band_processor.nms(test_img, width, height, out_img, n);
+        clock.tock(gpu_time);
+    } else {
+        seminar::KernelPlanner::Plan plan = planner->planNms(width, height, n);
+        plan.print();
+        
+        clock.tick();
+        planner->nms(plan, *test_img_gpu, out_img_gpu->device(oclw::Image::READ_WRITE), width, height, n);
+        gpu_controller->finish();
+        clock.tock(gpu_time);
+        
+        gpu_result = out_img_gpu->host(oclw::Image::READ);
+    }
     
-    out_img_gpu->readData(out_img, width*height);
-    uint8_to_png(out_img, width, height).write("resources/test_image_nms_gpu.png");
+    seminar::writePng("resources/test_image_nms_gpu.png", gpu_result, width, width, height);
     
     /* Print results */
     std::cout << "CPU running time: " << cpu_time << " ms" << std::endl;
     std::cout << "OpenCL device running time: " << gpu_time << " ms" << std::endl;
     
     
+#pragma mark Testing: Non-Maximum Suppression with large windows
+    std::cout << "\nStarting Non-Maximum Suppression test with large windows (neighbourhood check vs separable running max)" << std::endl;
+    
+    {
+        std::vector<uint8_t> running_max_maxima (width * height);
+        double check_time, running_max_time;
+        const unsigned int large_n[] = { 8, 16 };
+        
+        for (int i = 0; i < 2; i++) {
+            const unsigned int nl = large_n[i];
+            
+            if (width <= 2 * nl || height <= 2 * nl)
+                continue;
+            
+            /* Perform calculation on CPU */
+            memset(out_img, 0, width*height);
+            clock.tick();
+            seminar::nsm(test_img, width, height, out_img, nl);
+            clock.tock(check_time);
+            
+            std::fill(running_max_maxima.begin(), running_max_maxima.end(), 0);
+            clock.tick();
+            seminar::nsmRunningMax(test_img, width, height, &running_max_maxima[0], nl);
+            clock.tock(running_max_time);
+            
+            std::cout << "n = " << nl << ", CPU neighbourhood check: " << check_time << " ms, CPU running max: " << running_max_time << " ms, "
+                      << (memcmp(out_img, &running_max_maxima[0], width*height) ? "results differ" : "results identical") << std::endl;
+            
+            if (banded)
+                continue;
+            
+            /* Perform calculation on GPU, planned variant against naive kernel */
+            seminar::KernelPlanner::Plan plan = planner->planNms(width, height, nl);
+            plan.print();
+            
+            try {
+                out_img_gpu->clear();
+                clock.tick();
+                planner->nms(plan, *test_img_gpu, out_img_gpu->device(oclw::Image::READ_WRITE), width, height, nl);
+                gpu_controller->finish();
+                clock.tock(running_max_time);
+                
+                std::copy(out_img_gpu->host(oclw::Image::READ), out_img_gpu->host(oclw::Image::READ) + width*height, running_max_maxima.begin());
+                
+                out_img_gpu->clear();
+                clock.tick();
+                nms_task_kernel->launch(plan.global_size, *test_img_gpu, out_img_gpu->device(oclw::Image::READ_WRITE), width, height, (int)nl);
+                gpu_controller->finish();
+                clock.tock(check_time);
+            } catch (oclw::Exception e) {
+                std::cout << "Executing kernel error: " << e.what() << std::endl;
+                return 0;
+            }
+            
+            std::cout << "n = " << nl << ", OpenCL device naive: " << check_time << " ms, planned: " << running_max_time << " ms, "
+                      << (memcmp(out_img_gpu->host(oclw::Image::READ), &running_max_maxima[0], width*height) ? "results differ" : "results identical")
+                      << std::endl;
+        }
+    }
+    
+    
 #pragma mark Testing: Convolution 2D   
     std::cout << "\nStarting Convolution 2D algorithm test" << std::endl;
     std::cout << "Performing operations on the CPU and on the OpenCL device" << std::endl;
@@ -201,53 +326,603 @@ int main (int argc, const char * argv[]) {
     
     /* Perform calculation on CPU (simple version) */
     clock.tick();
-    seminar::convolution2d(test_img, out_img, kernel, width, out_width, out_height, kernel_size);
+    seminar::convolution2d(test_img, out_img, (const uint8_t*)kernel, width, out_width, out_height, kernel_size);
     clock.tock(cpu_time);
     
-    uint8_to_png(out_img, out_width, out_height).write("resources/test_image_blob_cpu.png");
+    seminar::writePng("resources/test_image_blob_cpu.png", out_img, out_width, out_width, out_height);
     
     /* Perform calculation on GPU (simple version) */
-    cnv_task_kernel->setArgument(0, *test_img_gpu);
-    cnv_task_kernel->setArgument(1, *out_img_gpu);
-    cnv_task_kernel->setArgument(2, *kernel_gpu);
-    cnv_task_kernel->setArgument(3, sizeof(int), &width);
-    cnv_task_kernel->setArgument(4, sizeof(int), &out_width);
-    cnv_task_kernel->setArgument(5, sizeof(int), &out_height);
-    cnv_task_kernel->setArgument(6, sizeof(int), &kernel_size);
-    
     try {
-        clock.tick();
-        cnv_task_kernel->execute(oclw::Kernel::NDRange::range2D(out_width, out_height),
-                                 oclw::Kernel::NDRange::range2D(local_work_size_x, local_work_size_y));
-        clock.tock(gpu_time);
+        if (banded) {
+            /* Includes transfers of all bands */
+            clock.tick();
+            band_processor.convolve2d(test_img, out_img, (const uint8_t*)kernel, width, out_width, out_height, kernel_size);
+            clock.tock(gpu_time);
+        } else {
+            seminar::KernelPlanner::Plan plan = planner->planConvolve2d(out_width, out_height, kernel_size);
+            plan.print();
+            
+            clock.tick();
+            planner->convolve2d(plan, *test_img_gpu, out_img_gpu->device(oclw::Image::WRITE), *kernel_gpu,
+                                width, out_width, out_height, kernel_size);
+            gpu_controller->finish();
+            clock.tock(gpu_time);
+            
+            gpu_result = out_img_gpu->host(oclw::Image::READ);
+        }
     } catch (oclw::Exception e) {
         std::cout << "Executing kernel error: " << e.what() << std::endl;
         return 0;
     }
     
-    out_img_gpu->readData(out_img, width*height);
-    uint8_to_png(out_img, out_width, out_height).write("resources/test_image_blob_gpu.png");
+    seminar::writePng("resources/test_image_blob_gpu.png", gpu_result, out_width, out_width, out_height);
     
     /* Print results */
     std::cout << "CPU running time: " << cpu_time << " ms" << std::endl;
     std::cout << "OpenCL device running time: " << gpu_time << " ms" << std::endl;
 
     
+#pragma mark Testing: Feature extraction
+    const float harris_threshold = 1e5f;
+    std::vector<seminar::Keypoint> keypoints;
+    
+    std::cout << "\nStarting feature extraction test (Sobel, Harris, min/max NMS with n = " << n << ")" << std::endl;
+    
+    if (banded) {
+        std::cout << "Skipped on the OpenCL device, image does not fit into its memory" << std::endl;
+    } else {
+        size_t found;
+        
+        try {
+            seminar::FeatureExtractor extractor (gpu_controller, gpu_program);
+            
+            clock.tick();
+            found = extractor.extract(*test_img_gpu, width, height, n, harris_threshold, keypoints);
+            clock.tock(gpu_time);
+        } catch (oclw::Exception e) {
+            std::cout << "Executing kernel error: " << e.what() << std::endl;
+            return 0;
+        }
+        
+        /* Maxima are white, minima gray */
+        size_t maxima_count = 0;
+        memset(out_img, 0, width*height);
+        
+        for (size_t i = 0; i < keypoints.size(); i++) {
+            out_img[keypoints[i].y * width + keypoints[i].x] = keypoints[i].type > 0 ? 255 : 128;
+            maxima_count += keypoints[i].type > 0;
+        }
+        
+        seminar::writePng("resources/test_image_features_gpu.png", out_img, width, width, height);
+        
+        std::cout << "Found " << maxima_count << " maxima and " << keypoints.size() - maxima_count << " minima";
+        if (found > keypoints.size())
+            std::cout << " (" << found - keypoints.size() << " more did not fit into the list)";
+        std::cout << std::endl;
+        std::cout << "OpenCL device running time (with keypoint readback): " << gpu_time << " ms" << std::endl;
+    }
+    
+    
+#pragma mark Testing: Descriptor matching
+    /* Second frame is the image moved by (-shift_x, -shift_y) */
+    const int shift_x = 2, shift_y = 1;
+    const int match_radius = 8;
+    
+    std::cout << "\nStarting descriptor matching test (second frame shifted by " << shift_x << ", " << shift_y << ")" << std::endl;
+    
+    if (banded) {
+        std::cout << "Skipped on the OpenCL device, image does not fit into its memory" << std::endl;
+    } else {
+        std::vector<uint8_t> frame (width * height);
+        for (unsigned int y = 0; y < height; y++)
+            for (unsigned int x = 0; x < width; x++)
+                frame[y * width + x] = test_img[std::min(y + shift_y, height - 1) * width + std::min(x + shift_x, width - 1)];
+        
+        std::vector<seminar::Keypoint> frame_keypoints;
+        std::vector<seminar::Descriptor> descriptors, frame_descriptors;
+        std::vector<seminar::Match> cpu_matches, gpu_matches;
+        
+        try {
+            oclw::Handle<oclw::MemoryBuffer> frame_gpu (gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, width * height));
+            frame_gpu->writeData(&frame[0], width * height);
+            
+            seminar::FeatureExtractor extractor (gpu_controller, gpu_program);
+            extractor.extract(*frame_gpu, width, height, n, harris_threshold, frame_keypoints);
+            
+            std::cout << keypoints.size() << " query and " << frame_keypoints.size() << " train keypoints, Hamming distance" << std::endl;
+            
+            /* Perform calculation on CPU, brute force and with search radius */
+            clock.tick();
+            seminar::describe(test_img, width, height, keypoints, seminar::HAMMING, descriptors);
+            seminar::describe(&frame[0], width, height, frame_keypoints, seminar::HAMMING, frame_descriptors);
+            seminar::matchDescriptors(descriptors, keypoints, frame_descriptors, frame_keypoints, seminar::HAMMING, 0, cpu_matches);
+            clock.tock(cpu_time);
+            
+            std::cout << "CPU brute force running time: " << cpu_time << " ms ("
+                      << keypoints.size() / (cpu_time / 1000.0) << " matches/s)" << std::endl;
+            
+            std::vector<seminar::Match> bucketed_matches;
+            
+            clock.tick();
+            seminar::matchDescriptors(descriptors, keypoints, frame_descriptors, frame_keypoints, seminar::HAMMING, match_radius, bucketed_matches);
+            clock.tock(cpu_time);
+            
+            size_t correct = 0;
+            for (size_t i = 0; i < bucketed_matches.size(); i++)
+                if (bucketed_matches[i].train >= 0 && frame_keypoints[bucketed_matches[i].train].x == keypoints[i].x - shift_x &&
+                    frame_keypoints[bucketed_matches[i].train].y == keypoints[i].y - shift_y)
+                    correct++;
+            
+            std::cout << "CPU grid bucketed (radius " << match_radius << ") running time, without descriptors: " << cpu_time << " ms ("
+                      << keypoints.size() / (cpu_time / 1000.0) << " matches/s), " << correct << " matches agree with the shift" << std::endl;
+            
+            /* Perform calculation on GPU, brute force with tiles in local memory */
+            seminar::Matcher matcher (gpu_controller, gpu_program);
+            
+            clock.tick();
+            matcher.describe(*test_img_gpu, width, height, keypoints, seminar::HAMMING, descriptors);
+            matcher.describe(*frame_gpu, width, height, frame_keypoints, seminar::HAMMING, frame_descriptors);
+            matcher.match(descriptors, keypoints, frame_descriptors, frame_keypoints, seminar::HAMMING, 0, gpu_matches);
+            clock.tock(gpu_time);
+        } catch (oclw::Exception e) {
+            std::cout << "Executing kernel error: " << e.what() << std::endl;
+            return 0;
+        }
+        
+        size_t differences = 0;
+        for (size_t i = 0; i < cpu_matches.size(); i++)
+            differences += cpu_matches[i].train != gpu_matches[i].train || cpu_matches[i].distance != gpu_matches[i].distance;
+        
+        std::cout << "OpenCL device brute force running time (with transfers): " << gpu_time << " ms ("
+                  << keypoints.size() / (gpu_time / 1000.0) << " matches/s), "
+                  << (differences ? "results differ from CPU" : "results identical to CPU") << std::endl;
+    }
+    
+    
+#pragma mark Testing: Box filter
+    std::cout << "\nStarting box filter test (integral image, cost does not depend on window size)" << std::endl;
+    
+    {
+        std::vector<uint32_t> table ((width + 1) * (height + 1));
+        const int windows[] = { 31, 63 };
+        const char* paths[] = { "resources/test_image_box31_cpu.png", "resources/test_image_box63_cpu.png" };
+        
+        for (int i = 0; i < 2; i++) {
+            const int window = windows[i];
+            const int box_width = width - window + 1;
+            const int box_height = height - window + 1;
+            
+            if (box_width <= 0 || box_height <= 0)
+                continue;
+            
+            /* Perform calculation on CPU, including the table */
+            clock.tick();
+            seminar::integralImage(test_img, &table[0], NULL, width, height);
+            seminar::boxFilter(&table[0], out_img, width, box_width, box_height, window);
+            clock.tock(cpu_time);
+            
+            seminar::writePng(paths[i], out_img, box_width, box_width, box_height);
+            std::cout << window << "x" << window << " window, CPU running time: " << cpu_time << " ms" << std::endl;
+            
+            if (banded)
+                continue;
+            
+            /* Perform calculation on GPU */
+            std::vector<uint8_t> box (box_width * box_height);
+            
+            try {
+                seminar::IntegralImage integral (gpu_controller, gpu_program);
+                oclw::Handle<oclw::MemoryBuffer> box_gpu (gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::WRITE, box.size()));
+                
+                clock.tick();
+                integral.build(*test_img_gpu, width, height);
+                integral.boxFilter(*box_gpu, box_width, box_height, window);
+                box_gpu->readData(&box[0], box.size());
+                clock.tock(gpu_time);
+            } catch (oclw::Exception e) {
+                std::cout << "Executing kernel error: " << e.what() << std::endl;
+                return 0;
+            }
+            
+            std::cout << window << "x" << window << " window, OpenCL device running time (with readback): " << gpu_time << " ms, "
+                      << (memcmp(&box[0], out_img, box.size()) ? "results differ from CPU" : "results identical to CPU") << std::endl;
+        }
+    }
+    
+    
+#pragma mark Testing: Median filter
+    std::cout << "\nStarting median filter test (histogram on the CPU, sorting network on the OpenCL device)" << std::endl;
+    
+    {
+        const int radii[] = { 1, 2, 15 };
+        const char* paths[] = { "resources/test_image_median1_cpu.png", "resources/test_image_median2_cpu.png",
+                                "resources/test_image_median15_cpu.png" };
+        const char* kernel_names[] = { "rank3x3", "rank5x5", NULL };
+        
+        for (int i = 0; i < 3; i++) {
+            const int radius = radii[i];
+            const int median = 2 * radius * (radius + 1);
+            const int median_width = width - 2 * radius;
+            const int median_height = height - 2 * radius;
+            
+            if (median_width <= 0 || median_height <= 0)
+                continue;
+            
+            /* Perform calculation on CPU */
+            clock.tick();
+            seminar::rankFilter(test_img, out_img, width, median_width, median_height, radius, median);
+            clock.tock(cpu_time);
+            
+            seminar::writePng(paths[i], out_img, median_width, median_width, median_height);
+            std::cout << 2 * radius + 1 << "x" << 2 * radius + 1 << " window, CPU running time: " << cpu_time << " ms" << std::endl;
+            
+            /* Perform calculation on GPU, sorting networks exist for small windows only */
+            if (banded || kernel_names[i] == NULL)
+                continue;
+            
+            try {
+                oclw::Kernel* rank_kernel = gpu_program->kernel(kernel_names[i]);
+                
+                clock.tick();
+                rank_kernel->launch(oclw::Kernel::NDRange::range2D(median_width, median_height), *test_img_gpu,
+                                    out_img_gpu->device(oclw::Image::WRITE), (int)width, median_width, median_height, median);
+                gpu_controller->finish();
+                clock.tock(gpu_time);
+            } catch (oclw::Exception e) {
+                std::cout << "Executing kernel error: " << e.what() << std::endl;
+                return 0;
+            }
+            
+            gpu_result = out_img_gpu->host(oclw::Image::READ);
+            std::cout << 2 * radius + 1 << "x" << 2 * radius + 1 << " window, OpenCL device running time: " << gpu_time << " ms, "
+                      << (memcmp(gpu_result, out_img, median_width * median_height) ? "results differ from CPU" : "results identical to CPU")
+                      << std::endl;
+        }
+    }
+    
+    
+#pragma mark Testing: Iterated smoothing
+    const unsigned int smooth_passes = 10;
+    
+    std::cout << "\nStarting iterated smoothing test (" << smooth_passes << " passes of 3x3 binomial filter)" << std::endl;
+    
+    /* Perform calculation on CPU, buffers swap roles after each pass */
+    {
+        std::vector<uint8_t> pass_buffer (width * height);
+        const uint8_t* src = test_img;
+        uint8_t* dst = (smooth_passes % 2) ? out_img : &pass_buffer[0];
+        
+        clock.tick();
+        for (unsigned int i = 0; i < smooth_passes; i++) {
+            seminar::smooth3x3(src, dst, width, height);
+            src = dst;
+            dst = (dst == out_img) ? &pass_buffer[0] : out_img;
+        }
+        clock.tock(cpu_time);
+    }
+    
+    seminar::writePng("resources/test_image_smooth_cpu.png", out_img, width, width, height);
+    std::cout << "CPU running time: " << cpu_time << " ms" << std::endl;
+    
+    /* Perform calculation on GPU, only the final result is read back */
+    if (banded) {
+        std::cout << "Skipped on the OpenCL device, image does not fit into its memory" << std::endl;
+    } else {
+        try {
+            clock.tick();
+            
+            oclw::PingPong chain (gpu_controller, width * height);
+            chain.write(test_img, width * height);
+            chain.iterate(smooth_task_kernel, smooth_passes, oclw::Kernel::NDRange::range2D(width, height),
+                          oclw::PingPong::Source(), oclw::PingPong::Target(), (int)width, (int)height);
+            chain.read(out_img, width * height);
+            
+            clock.tock(gpu_time);
+        } catch (oclw::Exception e) {
+            std::cout << "Executing kernel error: " << e.what() << std::endl;
+            return 0;
+        }
+        
+        seminar::writePng("resources/test_image_smooth_gpu.png", out_img, width, width, height);
+        
+        std::cout << "OpenCL device running time (with transfers): " << gpu_time << " ms" << std::endl;
+    }
+    
+    
+#pragma mark Testing: Host worker pool
+    {
+        seminar::WorkerPool& pool = seminar::WorkerPool::shared();
+        
+        /* Many small images: 128x128 crops of the test image */
+        const int crop = std::min(128, (int)std::min(width, height)) - kernel_size + 1;
+        const int calls = 500;
+        
+        std::cout << "\nStarting host worker pool test (" << pool.size() << " threads, " << calls << " calls on "
+                  << crop << "x" << crop << " images)" << std::endl;
+        
+        uint8_t* pool_out = pool.allocateImage(height, width);
+        
+        clock.tick();
+        for (int i = 0; i < calls; i++)
+            seminar::convolution2d(test_img, out_img, (const uint8_t*)kernel, width, crop, crop, kernel_size);
+        clock.tock(cpu_time);
+        
+        clock.tick();
+        for (int i = 0; i < calls; i++)
+            seminar::convolution2d(pool, test_img, pool_out, (const uint8_t*)kernel, width, crop, crop, kernel_size);
+        clock.tock(gpu_time);
+        
+        std::cout << "Convolution 2D, OpenMP: " << cpu_time * 1000 / calls << " us per call, worker pool: "
+                  << gpu_time * 1000 / calls << " us per call, "
+                  << (memcmp(out_img, pool_out, crop * crop) ? "results differ" : "results identical") << std::endl;
+        
+        memset(out_img, 0, width*height);
+        memset(pool_out, 0, width*height);
+        
+        clock.tick();
+        for (int i = 0; i < calls / 10; i++)
+            seminar::nsm(test_img, width, height, out_img, n);
+        clock.tock(cpu_time);
+        
+        clock.tick();
+        for (int i = 0; i < calls / 10; i++)
+            seminar::nsm(pool, test_img, width, height, pool_out, n);
+        clock.tock(gpu_time);
+        
+        std::cout << "NMS of the whole image, OpenMP: " << cpu_time * 10 / calls << " ms per call, worker pool: "
+                  << gpu_time * 10 / calls << " ms per call, "
+                  << (memcmp(out_img, pool_out, width*height) ? "results differ" : "results identical") << std::endl;
+        
+        free(pool_out);
+    }
+    
+    
 #pragma mark Finalize    
-    /* Delete allocated objects */
-    delete[] test_img;
-    delete[] out_img;
+    /* test_img and out_img are released with their buffers */
+    delete out_img_gpu;
+    delete planner;
+    
+    std::cout << std::endl;
+    gpu_controller->memoryReport().print();
+    
+    return 0;
+}
+
+
+bool create_kernels (oclw::Controller* gpu_controller, oclw::Program* gpu_program, oclw::Kernel*& nms_task_kernel,
+                     oclw::Kernel*& cnv_task_kernel, oclw::Kernel*& smooth_task_kernel, seminar::KernelPlanner*& planner) {
+    try {
+        nms_task_kernel = gpu_program->kernel("nms");
+        cnv_task_kernel = gpu_program->kernel("convolve2d");
+        smooth_task_kernel = gpu_program->kernel("smooth3x3");
+        
+        /* Picks kernel variants suited to the device */
+        planner = new seminar::KernelPlanner(gpu_controller, gpu_program);
+    } catch (oclw::Exception e) {
+        std::cout << "OpenCL program error: " << e.what() << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+
+int run_batch (oclw::Controller* gpu_controller, oclw::Kernel* cnv_task_kernel, const int8_t* kernel, int kernel_size,
+               unsigned int local_work_size_x, unsigned int local_work_size_y, const char* input_dir, const char* output_dir) {
+    Clock clock;
+    double sequential_time, pipelined_time;
+    unsigned int sequential_count, pipelined_count;
+    
+    std::vector<std::string> inputs = seminar::listPngFiles(input_dir);
+    
+    if (inputs.empty()) {
+        std::cout << "No PNG images found in " << input_dir << std::endl;
+        return -1;
+    }
+    
+    std::cout << std::endl << "Batch processing " << inputs.size() << " images (Convolution 2D)" << std::endl;
+    
+    try {
+        oclw::MemoryBuffer* kernel_gpu = gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*kernel_size*kernel_size);
+        kernel_gpu->writeData((void*)kernel, sizeof(uint8_t)*kernel_size*kernel_size);
+        
+        seminar::BatchPipeline pipeline (gpu_controller, cnv_task_kernel, kernel_gpu, kernel_size,
+                                         local_work_size_x, local_work_size_y);
+        
+        clock.tick();
+        sequential_count = pipeline.runSequential(inputs, output_dir);
+        clock.tock(sequential_time);
+        
+        clock.tick();
+        pipelined_count = pipeline.runPipelined(inputs, output_dir);
+        clock.tock(pipelined_time);
+    } catch (oclw::Exception e) {
+        std::cout << "Batch processing error: " << e.what() << std::endl;
+        return 0;
+    }
+    
+    /* Print results */
+    std::cout << "Sequential: " << sequential_count << " images in " << sequential_time << " ms ("
+              << sequential_count / (sequential_time / 1000.0) << " images/s)" << std::endl;
+    std::cout << "Pipelined:  " << pipelined_count << " images in " << pipelined_time << " ms ("
+              << pipelined_count / (pipelined_time / 1000.0) << " images/s)" << std::endl;
+    std::cout << "Speedup: " << sequential_time / pipelined_time << "x" << std::endl;
+    
+    return 0;
+}
+
+
+int run_mapped (oclw::Controller* gpu_controller, oclw::Kernel* cnv_task_kernel, oclw::Kernel* nms_task_kernel,
+                seminar::KernelPlanner* planner, const int8_t* kernel, int kernel_size, const char* input_path, const char* output_path, unsigned int width, unsigned int height) {
+    Clock clock;
+    double gpu_time;
+    
+    seminar::MappedImage* input;
+    seminar::MappedImage* output;
+    
+    try {
+        input = new seminar::MappedImage(input_path, width, height);
+    } catch (std::runtime_error e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    
+    /* Valid convolution, image is not padded */
+    int in_width = input->width();
+    int out_width = input->width() - kernel_size + 1;
+    int out_height = input->height() - kernel_size + 1;
+    
+    if (out_width <= 0 || out_height <= 0) {
+        std::cout << "Error: image is smaller than convolution kernel" << std::endl;
+        return -1;
+    }
+    
+    try {
+        output = seminar::MappedImage::create(output_path, out_width, out_height);
+    } catch (std::runtime_error e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    
+    std::cout << std::endl << "Convolution 2D of mapped " << input->width() << "x" << input->height() << " image ("
+              << (input->pageAligned() ? "zero-copy" : "single copy") << ")" << std::endl;
+    
+    seminar::BandProcessor band_processor (gpu_controller, cnv_task_kernel, nms_task_kernel);
+    
+    if (band_processor.needed(input->size(), output->size())) {
+        std::cout << "Image exceeds OpenCL device memory, processing in bands" << std::endl;
+        
+        try {
+            clock.tick();
+            band_processor.convolve2d(input->data(), output->data(), (const uint8_t*)kernel, in_width, out_width, out_height, kernel_size);
+            clock.tock(gpu_time);
+        } catch (oclw::Exception e) {
+            std::cout << "OpenCL device error: " << e.what() << std::endl;
+            return 0;
+        }
+        
+        std::cout << "Banded upload, convolution and readback completed in " << gpu_time << " ms" << std::endl;
+        
+        delete output;
+        delete input;
+        
+        return 0;
+    }
+    
+    try {
+        clock.tick();
+        
+        /* Buffers are released at the end of this block, before the mapping they may use */
+        oclw::Handle<oclw::MemoryBuffer> in_img_gpu (input->upload(gpu_controller));
+        oclw::Handle<oclw::MemoryBuffer> out_img_gpu (gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::WRITE, output->size()));
+        oclw::Handle<oclw::MemoryBuffer> kernel_gpu (gpu_controller->createMemoryBuffer(oclw::MemoryBuffer::READ, sizeof(uint8_t)*kernel_size*kernel_size));
+        kernel_gpu->writeData((void*)kernel, sizeof(uint8_t)*kernel_size*kernel_size);
+        
+        seminar::KernelPlanner::Plan plan = planner->planConvolve2d(out_width, out_height, kernel_size);
+        plan.print();
+        
+        planner->convolve2d(plan, *in_img_gpu, *out_img_gpu, *kernel_gpu, in_width, out_width, out_height, kernel_size);
+        
+        /* Result goes from the device straight into the mapped output file */
+        out_img_gpu->readData(output->data(), output->size());
+        
+        clock.tock(gpu_time);
+    } catch (oclw::Exception e) {
+        std::cout << "OpenCL device error: " << e.what() << std::endl;
+        return 0;
+    }
+    
+    std::cout << "Upload, convolution and readback completed in " << gpu_time << " ms" << std::endl;
+    
+    delete output;
+    delete input;
     
     return 0;
 }
 
 
-png::image<png::gray_pixel> uint8_to_png (uint8_t* image, unsigned int width, unsigned int height) {
-    png::image<png::gray_pixel> png_image(width, height);
+int run_color (oclw::Controller* gpu_controller, oclw::Program* gpu_program, const int8_t* kernel, int kernel_size,
+               const char* input_path, unsigned int nms_n) {
+    Clock clock;
+    double gpu_time;
     
-    for (size_t i = 0; i < height; i++)
-        for (size_t j = 0; j < width; j++)
-            png_image.set_pixel(j, i, image[i*width + j]);
+    /* Decoded with its channels and bit depth, pixels stay interleaved */
+    std::vector<uint8_t> pixels;
+    unsigned int width, height, channels, sample_size;
     
-    return png_image;
+    try {
+        seminar::PngReader png (input_path, false);
+        width = png.width();
+        height = png.height();
+        channels = png.channels();
+        sample_size = png.sampleSize();
+        
+        pixels.resize((size_t)width * height * channels * sample_size);
+        png.read(&pixels[0], width * channels * sample_size, height);
+    } catch (std::runtime_error e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    
+    std::cout << std::endl << "Image has " << channels << " channels of " << 8 * sample_size << " bits" << std::endl;
+    
+    if (width < (unsigned int)kernel_size || height < (unsigned int)kernel_size) {
+        std::cout << "Error: image is smaller than convolution kernel" << std::endl;
+        return -1;
+    }
+    
+    if (width <= 2 * nms_n || height <= 2 * nms_n) {
+        std::cout << "Error: image is smaller than NMS neighbourhood" << std::endl;
+        return -1;
+    }
+    
+    try {
+        clock.tick();
+        seminar::ChannelProcessor processor (gpu_controller, gpu_program);
+        clock.tock(gpu_time);
+        std::cout << "Waited " << gpu_time << " ms for the OpenCL program build" << std::endl;
+        
+        unsigned int planes;
+        size_t pixel_size;
+        
+        /* NMS of every channel, one launch for all of them */
+        std::cout << "\nStarting per-channel Non-Maximum Suppression test (n = " << nms_n << ")" << std::endl;
+        
+        clock.tick();
+        processor.upload(&pixels[0], width, height, channels, sample_size);
+        planes = processor.planes();
+        pixel_size = planes * sample_size;
+        
+        std::vector<uint8_t> maxima ((size_t)width * height * pixel_size);
+        processor.nms(nms_n, &maxima[0]);
+        clock.tock(gpu_time);
+        
+        seminar::writePng("resources/test_image_color_nms_gpu.png", &maxima[0], width * pixel_size, width, height, planes, sample_size);
+        std::cout << "OpenCL device running time (with transfers): " << gpu_time << " ms" << std::endl;
+        
+        /* Convolution of every channel, input planes are still on the device */
+        std::cout << "\nStarting per-channel Convolution 2D test" << std::endl;
+        
+        const unsigned int out_width = width - kernel_size + 1;
+        const unsigned int out_height = height - kernel_size + 1;
+        std::vector<uint8_t> result ((size_t)out_width * out_height * pixel_size);
+        
+        clock.tick();
+        processor.convolve2d(kernel, kernel_size, &result[0]);
+        clock.tock(gpu_time);
+        
+        seminar::writePng("resources/test_image_color_blob_gpu.png", &result[0], out_width * pixel_size, out_width, out_height, planes, sample_size);
+        std::cout << "OpenCL device running time (with transfers): " << gpu_time << " ms" << std::endl;
+    } catch (oclw::Exception e) {
+        std::cout << "OpenCL error: " << e.what() << std::endl;
+        return 0;
+    } catch (std::runtime_error e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return -1;
+    }
+    
+    std::cout << std::endl;
+    gpu_controller->memoryReport().print();
+    
+    return 0;
 }
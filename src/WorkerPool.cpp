@@ -0,0 +1,228 @@
+//
+//  WorkerPool.cpp
+//  Seminar
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "ImageIO.h"
+#include "WorkerPool.h"
+
+namespace seminar {
+
+    /* Checks of a new call before sleeping, calls come in quick succession for small images */
+    static const int spin_count = 2000;
+
+    static void pinThread (std::thread& thread, int cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    WorkerPool::WorkerPool (unsigned int threads, const std::vector<int>& cpus)
+        : _generation (0), _pending (0), _body (NULL), _stop (false) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (unsigned int i = 0; i < threads; i++)
+            _workers.push_back(new Worker ());
+
+        for (unsigned int i = 1; i < threads; i++) {
+            _workers[i]->thread = std::thread (&WorkerPool::run, this, i);
+
+            if (!cpus.empty())
+                pinThread(_workers[i]->thread, cpus[i % cpus.size()]);
+        }
+    }
+
+    WorkerPool::~WorkerPool () {
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _stop = true;
+            _generation++;
+        }
+        _wake.notify_all();
+
+        for (size_t i = 0; i < _workers.size(); i++) {
+            if (_workers[i]->thread.joinable())
+                _workers[i]->thread.join();
+            delete _workers[i];
+        }
+    }
+
+    WorkerPool& WorkerPool::shared () {
+        static std::once_flag flag;
+        static WorkerPool* pool;
+
+        std::call_once(flag, [] () {
+            std::vector<int> cpus;
+            const char* list = getenv("SEMINAR_CPUS");
+
+            for (const char* c = list; c != NULL && *c != '\0'; c++)
+                if (c == list || c[-1] == ',')
+                    cpus.push_back(atoi(c));
+
+            pool = new WorkerPool (0, cpus);
+        });
+
+        return *pool;
+    }
+
+    unsigned int WorkerPool::size () const {
+        return _workers.size();
+    }
+
+    int WorkerPool::grain (int count) const {
+        return std::max(1, count / (int)(4 * _workers.size()));
+    }
+
+    bool WorkerPool::take (unsigned int index, Range& range) {
+        {
+            Worker* own = _workers[index];
+            std::lock_guard<std::mutex> lock (own->mutex);
+
+            if (!own->chunks.empty()) {
+                range = own->chunks.front();
+                own->chunks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < _workers.size(); i++) {
+            Worker* victim = _workers[(index + i) % _workers.size()];
+            std::lock_guard<std::mutex> lock (victim->mutex);
+
+            if (!victim->chunks.empty()) {
+                range = victim->chunks.back();
+                victim->chunks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int WorkerPool::drain () {
+        int drained = 0;
+
+        for (size_t i = 0; i < _workers.size(); i++) {
+            std::lock_guard<std::mutex> lock (_workers[i]->mutex);
+            drained += _workers[i]->chunks.size();
+            _workers[i]->chunks.clear();
+        }
+
+        return drained;
+    }
+
+    void WorkerPool::work (unsigned int index) {
+        Range range;
+
+        while (take(index, range)) {
+            int finished = 1;
+
+            try {
+                (*_body)(range.first, range.second);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock (_mutex);
+                    if (!_error)
+                        _error = std::current_exception();
+                }
+
+                /* Chunks left behind would run with the body of the next call */
+                finished += drain();
+            }
+
+            if ((_pending -= finished) == 0) {
+                std::lock_guard<std::mutex> lock (_mutex);
+                _done.notify_all();
+            }
+        }
+    }
+
+    void WorkerPool::run (unsigned int index) {
+        unsigned int seen = 0;
+
+        while (true) {
+            for (int i = 0; i < spin_count && _generation.load() == seen; i++)
+                std::this_thread::yield();
+
+            {
+                std::unique_lock<std::mutex> lock (_mutex);
+                while (_generation.load() == seen)
+                    _wake.wait(lock);
+
+                seen = _generation.load();
+                if (_stop)
+                    return;
+            }
+
+            work(index);
+        }
+    }
+
+    void WorkerPool::parallelFor (int count, int grain, const std::function<void (int, int)>& body) {
+        grain = std::max(grain, 1);
+
+        if (count <= grain || _workers.size() == 1) {
+            if (count > 0)
+                body(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> call_lock (_call_mutex);
+
+        /* Worker w gets chunks [w * chunks / n, (w + 1) * chunks / n) */
+        int chunks = (count + grain - 1) / grain;
+        int workers = _workers.size();
+
+        _body = &body;
+        _pending = chunks;
+
+        for (int w = 0; w < workers; w++) {
+            std::lock_guard<std::mutex> lock (_workers[w]->mutex);
+
+            for (int c = w * chunks / workers; c < (w + 1) * chunks / workers; c++)
+                _workers[w]->chunks.push_back(Range (c * grain, std::min((c + 1) * grain, count)));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _generation++;
+        }
+        _wake.notify_all();
+
+        work(0);
+
+        /* Others may still be finishing stolen chunks */
+        std::unique_lock<std::mutex> lock (_mutex);
+        while (_pending.load() != 0)
+            _done.wait(lock);
+
+        if (_error) {
+            std::exception_ptr error = _error;
+            _error = std::exception_ptr ();
+            std::rethrow_exception(error);
+        }
+    }
+
+    uint8_t* WorkerPool::allocateImage (int rows, size_t row_size) {
+        uint8_t* image = allocateAligned(rows * row_size);
+
+        parallelFor(rows, grain(rows), [&] (int begin, int end) {
+            memset(image + begin * row_size, 0, (end - begin) * row_size);
+        });
+
+        return image;
+    }
+}
@@ -0,0 +1,130 @@
+//
+//  WorkerPool.h
+//  Seminar
+//
+
+#ifndef Seminar_WorkerPool_h
+#define Seminar_WorkerPool_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace seminar {
+
+    /*! Persistent threads that run row-band tasks of host filters.
+     *
+     *  Threads are created once and wait for work between calls, so a call does
+     *  not pay for creating or waking a thread team the way a fresh
+     *  `#pragma omp parallel` region may. The calling thread works too.
+     *
+     *  parallelFor() splits the index range into chunks and gives each worker a
+     *  contiguous share of them. Worker takes chunks from the front of its own
+     *  share and, when it runs out, steals from the back of the others' shares,
+     *  so uneven bands (e.g. NMS of a busy region) do not leave workers idle.
+     *
+     *  \code
+     *  seminar::WorkerPool& pool = seminar::WorkerPool::shared();
+     *  uint8_t* image = pool.allocateImage(height, width);
+     *  pool.parallelFor(height, pool.grain(height), [&] (int begin, int end) {
+     *      for (int y = begin; y < end; y++)
+     *          process(image + y * width);
+     *  });
+     *  free(image);
+     *  \endcode
+     *
+     *  Calls from several threads are serialized.
+     */
+    class WorkerPool {
+    private:
+        typedef std::pair<int, int> Range;
+
+        /* Chunks of one worker, stolen from the back */
+        class Worker {
+        public:
+            std::mutex mutex;
+            std::deque<Range> chunks;
+            std::thread thread;
+        };
+
+        std::vector<Worker*> _workers;          /* _workers[0] is the calling thread */
+
+        std::mutex _call_mutex;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::atomic<unsigned int> _generation;
+        std::atomic<int> _pending;
+        const std::function<void (int, int)>* _body;
+        std::exception_ptr _error;              /* First exception thrown by _body, guarded by _mutex */
+        bool _stop;
+
+        WorkerPool (const WorkerPool&);
+        WorkerPool& operator= (const WorkerPool&);
+
+        /* Takes next chunk, own first, then stolen */
+        bool take (unsigned int index, Range& range);
+
+        /* Removes chunks no worker has started, returns their number */
+        int drain ();
+
+        /* Runs chunks until there are none left */
+        void work (unsigned int index);
+
+        /* Loop of pool threads */
+        void run (unsigned int index);
+
+    public:
+        /*! Starts threads - 1 pool threads.
+         *
+         *  \param threads Number of threads including the calling one, 0 for one per hardware thread.
+         *  \param cpus If not empty, pool thread i runs only on CPU cpus[i % cpus.size()] (Linux only).
+         */
+        WorkerPool (unsigned int threads = 0, const std::vector<int>& cpus = std::vector<int>());
+
+        /*! Stops and joins pool threads.
+         */
+        ~WorkerPool ();
+
+        /*! Pool used by the host filters, created on first call. CPUs it runs on can be
+         *  given as a comma separated list in SEMINAR_CPUS environment variable.
+         */
+        static WorkerPool& shared ();
+
+        /*! Returns number of threads, including the calling one.
+         */
+        unsigned int size () const;
+
+        /*! Grain the host filters use for count indices: a few chunks per thread, so
+         *  that stealing can even out busy regions.
+         */
+        int grain (int count) const;
+
+        /*! Calls body(begin, end) for chunks of at most grain indices covering [0, count),
+         *  in parallel, and returns when all are done. Body must not call parallelFor().
+         *  If body throws, chunks that have not started are skipped and the first
+         *  exception is rethrown in the calling thread once running chunks are done.
+         */
+        void parallelFor (int count, int grain, const std::function<void (int begin, int end)>& body);
+
+        /*! Allocates page aligned rows x row_size image (release it with free()) and zeroes
+         *  it with parallelFor() over rows and grain(rows), the split used by row-band
+         *  filters such as convolution2d. On NUMA systems, first write places pages in
+         *  memory of the node of the writing thread, so such filters working on an image
+         *  of the same rows and row_size mostly access local memory. That only holds if
+         *  pool threads are pinned (SEMINAR_CPUS) and for output images; nsm splits the
+         *  image by columns and does not benefit.
+         */
+        uint8_t* allocateImage (int rows, size_t row_size);
+    };
+}
+
+#endif
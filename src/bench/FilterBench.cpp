@@ -0,0 +1,382 @@
+//
+//  FilterBench.cpp
+//  Seminar
+//
+
+/*  End-to-end benchmark of the image filters: every CPU and OpenCL variant of
+ *  convolve2d and nms over a sweep of image sizes, kernel sizes and nms block
+ *  sizes. Each result is compared byte for byte with the CPU reference
+ *  (convolution2d and nsm), and the program exits with 1 if any of them differs,
+ *  so it can guard against regressions on a CPU-only OpenCL runtime as well.
+ *
+ *  CPU variants use all cores (OpenMP or the worker pool). Device data stays
+ *  on the device, device times cover the kernels only.
+ *  Nms only marks maxima, so its times include clearing the output.
+ *
+ *  Usage: filter_bench [-reps N] [-warmup N] [-sizes 512,1024] [-kernels 3,5,9] [-nms 2,4,8]
+ *                      [-csv PATH] [-json PATH]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../oclw/Controller.h"
+#include "../oclw/MemoryBuffer.h"
+#include "../oclw/Program.h"
+#include "../oclw/Handle.h"
+#include "../oclw/Exception.h"
+
+#include "../Clock.h"
+#include "../Filters.h"
+#include "../KernelPlanner.h"
+#include "../WorkerPool.h"
+
+#ifdef SEMINAR_EMBEDDED_PROGRAM
+/* Contents of src/cl_program.cl, generated by makefile */
+static const char* program_source =
+#include "cl_program.cl.inc"
+;
+#endif
+
+/* Result of one measurement, times are in milliseconds per operation */
+struct Result {
+    std::string operation;
+    std::string backend;
+    int width, height;
+    int parameter;              /* kernel size or nms n */
+    size_t pixels;              /* output pixels per operation */
+    double min, median, mean;
+    std::string check;          /* "reference", "identical" or "MISMATCH (...)" */
+
+    double mpixels () const {
+        return pixels / (median / 1000.0) / 1e6;
+    }
+};
+
+static unsigned int reps = 10;
+static unsigned int warmup = 2;
+static std::vector<Result> results;
+
+/* Runs operation warmup + reps times and records statistics of the timed runs */
+template <typename Operation>
+static Result& measure (const std::string& operation, const std::string& backend, int width, int height, int parameter,
+                        size_t pixels, Operation run) {
+    Clock clock;
+    std::vector<double> times;
+
+    for (unsigned int i = 0; i < warmup + reps; i++) {
+        double time;
+
+        clock.tick();
+        run();
+        clock.tock(time);
+
+        if (i >= warmup)
+            times.push_back(time);
+    }
+
+    std::sort(times.begin(), times.end());
+
+    Result result;
+    result.operation = operation;
+    result.backend = backend;
+    result.width = width;
+    result.height = height;
+    result.parameter = parameter;
+    result.pixels = pixels;
+    result.min = times.front();
+    result.median = times[times.size() / 2];
+    result.mean = 0;
+    for (size_t i = 0; i < times.size(); i++)
+        result.mean += times[i] / times.size();
+
+    results.push_back(result);
+    return results.back();
+}
+
+/* Compares output with the reference and records the outcome. Returns false on mismatch. */
+static bool check (Result& result, const std::vector<uint8_t>& reference, const std::vector<uint8_t>& output) {
+    size_t differing = 0, first = 0;
+
+    for (size_t i = 0; i < reference.size(); i++)
+        if (reference[i] != output[i] && differing++ == 0)
+            first = i;
+
+    if (differing == 0) {
+        result.check = "identical";
+        return true;
+    }
+
+    std::ostringstream text;
+    text << "MISMATCH (" << differing << " bytes, first at x = " << first % result.width << ", y = " << first / result.width << ")";
+    result.check = text.str();
+    return false;
+}
+
+/* Deterministic noise, the same on every run */
+static void fillNoise (std::vector<uint8_t>& data, uint32_t seed) {
+    for (size_t i = 0; i < data.size(); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = seed >> 24;
+    }
+}
+
+static std::vector<int> parseList (const char* text) {
+    std::vector<int> values;
+    std::istringstream stream (text);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+        if (atoi(item.c_str()) > 0)
+            values.push_back(atoi(item.c_str()));
+
+    return values;
+}
+
+static const char* variantName (seminar::KernelPlanner::Variant variant) {
+    switch (variant) {
+        case seminar::KernelPlanner::TILED: return "opencl tiled";
+        case seminar::KernelPlanner::VECTORIZED: return "opencl vectorized";
+        case seminar::KernelPlanner::SEPARABLE: return "opencl separable";
+        default: return "opencl naive";
+    }
+}
+
+/* Valid convolution of size x size image, output is (size - k + 1)^2 */
+static bool benchConvolve2d (oclw::Controller* controller, seminar::KernelPlanner& planner, int size, int k) {
+    static const seminar::KernelPlanner::Variant variants[] = {
+        seminar::KernelPlanner::NAIVE, seminar::KernelPlanner::TILED, seminar::KernelPlanner::VECTORIZED
+    };
+
+    const int width = size - k + 1, height = size - k + 1;
+    const size_t pixels = (size_t)width * height;
+    seminar::WorkerPool& pool = seminar::WorkerPool::shared();
+    bool ok = true;
+
+    std::vector<uint8_t> image ((size_t)size * size), weights (k * k), reference (pixels), output (pixels);
+    fillNoise(image, size);
+    fillNoise(weights, k);
+
+    measure("convolve2d", "cpu scalar", width, height, k, pixels, [&] () {
+        seminar::convolution2d(&image[0], &reference[0], &weights[0], size, width, height, k);
+    }).check = "reference";
+
+    memset(&output[0], 0, pixels);
+    ok &= check(measure("convolve2d", "cpu sse2", width, height, k, pixels, [&] () {
+        seminar::convolution2dSimd(&image[0], &output[0], &weights[0], size, width, height, k);
+    }), reference, output);
+
+    memset(&output[0], 0, pixels);
+    ok &= check(measure("convolve2d", "cpu worker pool", width, height, k, pixels, [&] () {
+        seminar::convolution2d(pool, &image[0], &output[0], &weights[0], size, width, height, k);
+    }), reference, output);
+
+    oclw::Handle<oclw::MemoryBuffer> in (controller->createMemoryBuffer(oclw::MemoryBuffer::READ, image.size()));
+    oclw::Handle<oclw::MemoryBuffer> out (controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, pixels));
+    oclw::Handle<oclw::MemoryBuffer> conv_kernel (controller->createMemoryBuffer(oclw::MemoryBuffer::READ, weights.size()));
+    in->writeData(&image[0], image.size());
+    conv_kernel->writeData(&weights[0], weights.size());
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        seminar::KernelPlanner::Plan plan;
+
+        try {
+            plan = planner.planConvolve2d(width, height, k, variants[v]);
+        } catch (oclw::Exception e) {
+            std::cout << "convolve2d " << variantName(variants[v]) << " skipped: " << e.what() << std::endl;
+            continue;
+        }
+
+        /* Output of the previous variant must not pass for this one */
+        out->fill(0);
+
+        Result& result = measure("convolve2d", variantName(variants[v]), width, height, k, pixels, [&] () {
+            planner.convolve2d(plan, *in, *out, *conv_kernel, size, width, height, k);
+            controller->finish();
+        });
+
+        out->readData(&output[0], pixels);
+        ok &= check(result, reference, output);
+    }
+
+    return ok;
+}
+
+static bool benchNms (oclw::Controller* controller, seminar::KernelPlanner& planner, int size, int n) {
+    static const seminar::KernelPlanner::Variant variants[] = {
+        seminar::KernelPlanner::NAIVE, seminar::KernelPlanner::SEPARABLE
+    };
+
+    const size_t pixels = (size_t)size * size;
+    seminar::WorkerPool& pool = seminar::WorkerPool::shared();
+    bool ok = true;
+
+    std::vector<uint8_t> image (pixels), reference (pixels), output (pixels);
+    fillNoise(image, size + n);
+
+    measure("nms", "cpu scalar", size, size, n, pixels, [&] () {
+        memset(&reference[0], 0, pixels);
+        seminar::nsm(&image[0], size, size, &reference[0], n);
+    }).check = "reference";
+
+    ok &= check(measure("nms", "cpu worker pool", size, size, n, pixels, [&] () {
+        memset(&output[0], 0, pixels);
+        seminar::nsm(pool, &image[0], size, size, &output[0], n);
+    }), reference, output);
+
+    ok &= check(measure("nms", "cpu running max", size, size, n, pixels, [&] () {
+        memset(&output[0], 0, pixels);
+        seminar::nsmRunningMax(&image[0], size, size, &output[0], n);
+    }), reference, output);
+
+    oclw::Handle<oclw::MemoryBuffer> in (controller->createMemoryBuffer(oclw::MemoryBuffer::READ, pixels));
+    oclw::Handle<oclw::MemoryBuffer> maxima (controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, pixels));
+    in->writeData(&image[0], pixels);
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        seminar::KernelPlanner::Plan plan = planner.planNms(size, size, n, variants[v]);
+
+        Result& result = measure("nms", variantName(variants[v]), size, size, n, pixels, [&] () {
+            maxima->fill(0);
+            planner.nms(plan, *in, *maxima, size, size, n);
+            controller->finish();
+        });
+
+        maxima->readData(&output[0], pixels);
+        ok &= check(result, reference, output);
+    }
+
+    return ok;
+}
+
+static void printTable () {
+    std::string group;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+
+        std::ostringstream name;
+        name << r.operation << " " << r.width << "x" << r.height << (r.operation == "nms" ? ", n = " : ", kernel ") << r.parameter;
+
+        if (name.str() != group) {
+            group = name.str();
+            std::cout << std::endl << group << std::endl;
+            std::cout << std::left << std::setw(24) << "" << std::right
+                      << std::setw(12) << "min [ms]" << std::setw(12) << "median [ms]" << std::setw(12) << "Mpix/s"
+                      << "  check" << std::endl;
+        }
+
+        std::cout << std::left << std::setw(24) << ("  " + r.backend) << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << r.min << std::setw(12) << r.median << std::setprecision(1) << std::setw(12) << r.mpixels()
+                  << "  " << r.check << std::endl;
+    }
+}
+
+static void writeCsv (std::ostream& out) {
+    out << "operation,backend,width,height,parameter,min_ms,median_ms,mean_ms,mpix_per_s,check\n";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << r.operation << "," << r.backend << "," << r.width << "," << r.height << "," << r.parameter << ","
+            << r.min << "," << r.median << "," << r.mean << "," << r.mpixels() << ",\"" << r.check << "\"\n";
+    }
+}
+
+static void writeJson (std::ostream& out, const oclw::Controller::Info& info) {
+    out << "{\n  \"device\": \"" << info.vendor << " " << info.name << "\",\n";
+    out << "  \"cpu_threads\": " << seminar::WorkerPool::shared().size() << ",\n";
+    out << "  \"warmup\": " << warmup << ",\n  \"repetitions\": " << reps << ",\n";
+    out << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    {\"operation\": \"" << r.operation << "\", \"backend\": \"" << r.backend << "\", \"width\": " << r.width
+            << ", \"height\": " << r.height << ", \"parameter\": " << r.parameter << ", \"min_ms\": " << r.min
+            << ", \"median_ms\": " << r.median << ", \"mean_ms\": " << r.mean << ", \"mpix_per_s\": " << r.mpixels()
+            << ", \"check\": \"" << r.check << "\"}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n}\n";
+}
+
+int main (int argc, const char* argv[]) {
+    std::vector<int> sizes = parseList("512,1024,2048");
+    std::vector<int> kernel_sizes = parseList("3,5,9");
+    std::vector<int> nms_sizes = parseList("2,4,8");
+    const char* csv_path = NULL;
+    const char* json_path = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-reps") == 0)
+            reps = std::max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "-warmup") == 0)
+            warmup = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-sizes") == 0)
+            sizes = parseList(argv[i + 1]);
+        else if (strcmp(argv[i], "-kernels") == 0)
+            kernel_sizes = parseList(argv[i + 1]);
+        else if (strcmp(argv[i], "-nms") == 0)
+            nms_sizes = parseList(argv[i + 1]);
+        else if (strcmp(argv[i], "-csv") == 0)
+            csv_path = argv[i + 1];
+        else if (strcmp(argv[i], "-json") == 0)
+            json_path = argv[i + 1];
+    }
+
+    bool ok = true;
+
+    try {
+        oclw::Controller* controller = oclw::Controller::shared();
+        oclw::Controller::Info info = controller->getInfo();
+        info.print();
+
+        oclw::Program* program = controller->createProgramObject();
+#ifdef SEMINAR_EMBEDDED_PROGRAM
+        program->compileFromSourceString(program_source);
+#else
+        program->compileFromSourceFile("src/cl_program.cl");
+#endif
+
+        seminar::KernelPlanner planner (controller, program);
+
+        for (size_t s = 0; s < sizes.size(); s++) {
+            for (size_t k = 0; k < kernel_sizes.size(); k++)
+                if (kernel_sizes[k] <= sizes[s])
+                    ok &= benchConvolve2d(controller, planner, sizes[s], kernel_sizes[k]);
+
+            for (size_t n = 0; n < nms_sizes.size(); n++)
+                if (2 * nms_sizes[n] + 1 <= sizes[s])
+                    ok &= benchNms(controller, planner, sizes[s], nms_sizes[n]);
+        }
+
+        printTable();
+
+        if (csv_path != NULL) {
+            std::ofstream csv (csv_path);
+            writeCsv(csv);
+        }
+
+        if (json_path != NULL) {
+            std::ofstream json (json_path);
+            writeJson(json, info);
+        }
+    } catch (oclw::Exception e) {
+        std::cout << "OpenCL error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    if (!ok) {
+        std::cout << std::endl << "Some results differ from the CPU reference." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
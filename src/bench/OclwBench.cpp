@@ -0,0 +1,284 @@
+//
+//  OclwBench.cpp
+//  Seminar
+//
+
+/*  Micro-benchmarks of the OCLW wrapper itself: kernel launch overhead,
+ *  argument setting and host <-> device transfers.
+ *
+ *  Usage: oclw_bench [-reps N] [-warmup N] [-max-size BYTES] [-json PATH]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../oclw/Controller.h"
+#include "../oclw/MemoryBuffer.h"
+#include "../oclw/Program.h"
+#include "../oclw/Kernel.h"
+#include "../oclw/Exception.h"
+
+#include "../Clock.h"
+
+static const char* bench_source =
+    "__kernel void empty () {}\n"
+    "__kernel void args (__global uchar* a, __global uchar* b, int c, int d, int e) {}\n";
+
+/* Result of one measurement, times are in milliseconds per operation */
+struct Result {
+    std::string group;
+    std::string name;
+    size_t bytes;
+    double min, median, mean;
+
+    /* Operations per second for latency results, GB/s for transfer results */
+    double rate () const {
+        return bytes ? bytes / (median / 1000.0) / 1e9 : 1000.0 / median;
+    }
+};
+
+static unsigned int reps = 20;
+static unsigned int warmup = 3;
+static std::vector<Result> results;
+
+/* Runs operation warmup + reps times and records statistics of the timed runs.
+ * Each run executes the operation batch times, reported time is per operation.
+ */
+template <typename Operation>
+static void measure (const std::string& group, const std::string& name, size_t bytes, unsigned int batch, Operation operation) {
+    Clock clock;
+    std::vector<double> times;
+
+    for (unsigned int i = 0; i < warmup + reps; i++) {
+        double time;
+
+        clock.tick();
+        for (unsigned int b = 0; b < batch; b++)
+            operation();
+        clock.tock(time);
+
+        if (i >= warmup)
+            times.push_back(time / batch);
+    }
+
+    std::sort(times.begin(), times.end());
+
+    Result result;
+    result.group = group;
+    result.name = name;
+    result.bytes = bytes;
+    result.min = times.front();
+    result.median = times[times.size() / 2];
+    result.mean = 0;
+    for (size_t i = 0; i < times.size(); i++)
+        result.mean += times[i] / times.size();
+
+    results.push_back(result);
+}
+
+static std::string sizeName (size_t bytes) {
+    std::ostringstream name;
+
+    if (bytes >= (1 << 30))
+        name << bytes / (1 << 30) << " GB";
+    else if (bytes >= (1 << 20))
+        name << bytes / (1 << 20) << " MB";
+    else
+        name << bytes / (1 << 10) << " KB";
+
+    return name.str();
+}
+
+static void benchLaunch (oclw::Controller* controller, oclw::Program* program) {
+    oclw::Kernel* empty = program->createKernel("empty");
+    oclw::Kernel::NDRange one = oclw::Kernel::NDRange::range1D(1);
+
+    /* Enqueue, run and wait, as done by Kernel::execute */
+    measure("launch", "execute (blocking)", 0, 1, [&] () {
+        empty->execute(oclw::Kernel::NDRange::range1D(1));
+    });
+
+    /* Host side cost of an enqueue when launches are not waited for one by one */
+    measure("launch", "executeAsync (100 per finish)", 0, 100, [&] () {
+        empty->executeAsync(one);
+    });
+    controller->finish();
+
+    measure("launch", "executeAsync + finish", 0, 1, [&] () {
+        empty->executeAsync(one);
+        controller->finish();
+    });
+}
+
+static void benchArguments (oclw::Controller* controller, oclw::Program* program) {
+    oclw::Kernel* args = program->createKernel("args");
+    oclw::MemoryBuffer* a = controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, 1024);
+    oclw::MemoryBuffer* b = controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, 1024);
+    int value = 42;
+
+    /* Same value is recognized and not passed to OpenCL again */
+    measure("arguments", "setArgument (int, unchanged)", 0, 1000, [&] () {
+        args->setArgument(2, sizeof(int), &value);
+    });
+
+    measure("arguments", "setArgument (int, changing)", 0, 1000, [&] () {
+        value++;
+        args->setArgument(2, sizeof(int), &value);
+    });
+
+    measure("arguments", "setArgument (MemoryBuffer)", 0, 1000, [&] () {
+        args->setArgument(0, *a);
+    });
+
+    /* Typical launch: all arguments set, then executed */
+    measure("arguments", "5 x setArgument + execute", 0, 1, [&] () {
+        args->setArgument(0, *a);
+        args->setArgument(1, *b);
+        args->setArgument(2, sizeof(int), &value);
+        args->setArgument(3, sizeof(int), &value);
+        args->setArgument(4, sizeof(int), &value);
+        args->execute(oclw::Kernel::NDRange::range1D(1));
+    });
+
+    /* Checked binding, one argument changes from launch to launch */
+    measure("arguments", "bind (1 of 5 changed) + execute", 0, 1, [&] () {
+        value++;
+        args->bind(*a, *b, value, 1, 2);
+        args->execute(oclw::Kernel::NDRange::range1D(1));
+    });
+}
+
+static void benchTransfers (oclw::Controller* controller, size_t max_size) {
+    for (size_t size = 1024; size <= max_size; size *= 4) {
+        std::string group = "transfer " + sizeName(size);
+
+        oclw::MemoryBuffer* device = controller->createMemoryBuffer(oclw::MemoryBuffer::READ_WRITE, size);
+        uint8_t* pageable = new uint8_t[size];
+        memset(pageable, 1, size);
+
+        measure(group, "writeData pageable", size, 1, [&] () { device->writeData(pageable, size); });
+        measure(group, "readData pageable", size, 1, [&] () { device->readData(pageable, size); });
+
+        delete[] pageable;
+
+        /* Pinned host memory used as transfer source/destination */
+        oclw::MemoryBuffer* staging = controller->createMemoryBuffer(oclw::MemoryBuffer::PINNED, size);
+        uint8_t* pinned = (uint8_t*)staging->map();
+        memset(pinned, 1, size);
+
+        measure(group, "writeData pinned", size, 1, [&] () { device->writeData(pinned, size); });
+        measure(group, "readData pinned", size, 1, [&] () { device->readData(pinned, size); });
+
+        /* Map instead of copy: host writes/reads through mapping of device buffer */
+        measure(group, "map write + unmap", size, 1, [&] () {
+            void* ptr = device->map(oclw::MemoryBuffer::MAP_WRITE);
+            memcpy(ptr, pinned, size);
+            device->unmap(ptr);
+        });
+        measure(group, "map read + unmap", size, 1, [&] () {
+            void* ptr = device->map(oclw::MemoryBuffer::MAP_READ);
+            memcpy(pinned, ptr, size);
+            device->unmap(ptr);
+        });
+
+        staging->unmap(pinned);
+
+        /* Largest sizes would not fit next to each other */
+        controller->release(staging);
+        controller->release(device);
+    }
+}
+
+static void printTable () {
+    std::string group;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+
+        if (r.group != group) {
+            group = r.group;
+            std::cout << std::endl << group << std::endl;
+            std::cout << std::left << std::setw(34) << "" << std::right
+                      << std::setw(12) << "min [us]" << std::setw(12) << "median [us]" << std::setw(12) << "mean [us]"
+                      << std::setw(12) << (r.bytes ? "GB/s" : "ops/s") << std::endl;
+        }
+
+        std::cout << std::left << std::setw(34) << ("  " + r.name) << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << r.min * 1000 << std::setw(12) << r.median * 1000 << std::setw(12) << r.mean * 1000
+                  << std::setw(12) << r.rate() << std::endl;
+    }
+}
+
+static void writeJson (std::ostream& out, const oclw::Controller::Info& info) {
+    out << "{\n  \"device\": \"" << info.vendor << " " << info.name << "\",\n";
+    out << "  \"warmup\": " << warmup << ",\n  \"repetitions\": " << reps << ",\n";
+    out << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    {\"group\": \"" << r.group << "\", \"name\": \"" << r.name << "\", \"bytes\": " << r.bytes
+            << ", \"min_us\": " << r.min * 1000 << ", \"median_us\": " << r.median * 1000 << ", \"mean_us\": " << r.mean * 1000
+            << ", \"" << (r.bytes ? "gb_per_s" : "ops_per_s") << "\": " << r.rate() << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n}\n";
+}
+
+int main (int argc, const char* argv[]) {
+    size_t max_size = 1 << 30;
+    const char* json_path = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-reps") == 0)
+            reps = std::max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "-warmup") == 0)
+            warmup = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-max-size") == 0)
+            max_size = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-json") == 0)
+            json_path = argv[i + 1];
+    }
+
+    try {
+        oclw::Controller* controller = oclw::Controller::shared();
+        oclw::Controller::Info info = controller->getInfo();
+        info.print();
+
+        /* Largest transfer must fit in one allocation, and pinned + device copy in memory */
+        max_size = std::min(max_size, (size_t)info.max_mem_alloc_size);
+        max_size = std::min(max_size, (size_t)info.global_mem_size / 4);
+
+        oclw::Program* program = controller->createProgramObject();
+        program->compileFromSourceString(bench_source);
+
+        benchLaunch(controller, program);
+        benchArguments(controller, program);
+        benchTransfers(controller, max_size);
+
+        printTable();
+        std::cout << std::endl;
+        controller->memoryReport().print();
+
+        if (json_path != NULL) {
+            std::ofstream json (json_path);
+            writeJson(json, info);
+        } else {
+            std::cout << std::endl;
+            writeJson(std::cout, info);
+        }
+    } catch (oclw::Exception e) {
+        std::cout << "OpenCL error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -20,8 +20,8 @@ nms(__global uchar* image, __global uchar* maxima, unsigned int W, unsigned int
     
     unsigned int mi = i, mj = j;
     
-    for (unsigned int i2 = i; i2 <= i + n; i2++)
-        for (unsigned int j2 = j; j2 <= j + n; j2++)
+    for (unsigned int i2 = i; i2 <= min (i + n, W - 1); i2++)
+        for (unsigned int j2 = j; j2 <= min (j + n, H - 1); j2++)
             if (image[j2*W + i2] > image[mj*W + mi]) {
                 mi = i2;
                 mj = j2;
@@ -94,3 +94,789 @@ convolve2d(__global uchar* in, __global uchar* out, __constant uchar* conv_kerne
 //        }
 //    }
 }
+
+/*! 2D convolution with the input block of a work group kept in local memory.
+ *
+ *  Work group first copies its block of input, together with kernel_size - 1
+ *  halo rows and columns, into tile, so each input pixel is read from global
+ *  memory once per work group instead of up to kernel_size^2 times. Tile must
+ *  hold (local_size_x + kernel_size - 1) * (local_size_y + kernel_size - 1)
+ *  bytes. Global work size is rounded up to the local one, so work items
+ *  outside of the output only help with the copy.
+ */
+__kernel void
+convolve2d_tiled(__global uchar* in, __global uchar* out, __constant uchar* conv_kernel,
+                 int in_width, int width, int height, int kernel_size, __local uchar* tile)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int local_x = get_local_id(0);
+    const int local_y = get_local_id(1);
+    
+    const int group_x = get_group_id(0) * get_local_size(0);
+    const int group_y = get_group_id(1) * get_local_size(1);
+    const int tile_width = get_local_size(0) + kernel_size - 1;
+    const int tile_height = get_local_size(1) + kernel_size - 1;
+    const int in_height = height + kernel_size - 1;
+    
+    for (int ty = local_y; ty < tile_height; ty += get_local_size(1))
+        for (int tx = local_x; tx < tile_width; tx += get_local_size(0)) {
+            const int ix = group_x + tx;
+            const int iy = group_y + ty;
+            tile[ty * tile_width + tx] = (ix < in_width && iy < in_height) ? in[iy * in_width + ix] : 0;
+        }
+    
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    /* Wraps around the same way as uchar sum of convolve2d */
+    uint sum = 0;
+    for (int yy = 0; yy < kernel_size; yy++)
+        for (int xx = 0; xx < kernel_size; xx++)
+            sum += conv_kernel[yy * kernel_size + xx] * tile[(local_y + yy) * tile_width + local_x + xx];
+    
+    out[y * width + x] = (uchar)sum;
+}
+
+/*! 2D convolution in which each work item computes 4 neighbouring pixels of
+ *  an output row with vector loads. Global work size is ((width + 3) / 4, height).
+ */
+__kernel void
+convolve2d_vec4(__global uchar* in, __global uchar* out, __constant uchar* conv_kernel,
+                int in_width, int width, int height, int kernel_size)
+{
+    const int x = get_global_id(0) * 4;
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    if (x + 3 < width) {
+        uint4 sum = 0;
+        
+        for (int yy = 0; yy < kernel_size; yy++)
+            for (int xx = 0; xx < kernel_size; xx++) {
+                const uint weight = conv_kernel[yy * kernel_size + xx];
+                sum += weight * convert_uint4(vload4(0, in + (y + yy) * in_width + x + xx));
+            }
+        
+        vstore4(convert_uchar4(sum & (uint4)0xFF), 0, out + y * width + x);
+    } else {
+        /* Last pixels of a row whose width is not divisible by 4 */
+        for (int i = x; i < width; i++) {
+            uint sum = 0;
+            
+            for (int yy = 0; yy < kernel_size; yy++)
+                for (int xx = 0; xx < kernel_size; xx++)
+                    sum += conv_kernel[yy * kernel_size + xx] * in[(y + yy) * in_width + i + xx];
+            
+            out[y * width + i] = (uchar)sum;
+        }
+    }
+}
+
+/*! 3x3 binomial smoothing ([1 2 1] x [1 2 1] / 16, rounded). Output has the
+ *  same size as input (border pixels are repeated), so the filter can be
+ *  applied to its own result.
+ */
+__kernel void
+smooth3x3(__global uchar* in, __global uchar* out, int width, int height)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    const int left = max(x - 1, 0);
+    const int right = min(x + 1, width - 1);
+    
+    __global uchar* above = in + max(y - 1, 0) * width;
+    __global uchar* row = in + y * width;
+    __global uchar* below = in + min(y + 1, height - 1) * width;
+    
+    const uint sum = above[left] + 2 * above[x] + above[right]
+                   + 2 * (row[left] + 2 * row[x] + row[right])
+                   + below[left] + 2 * below[x] + below[right];
+    
+    out[y * width + x] = (uchar)((sum + 8) >> 4);
+}
+
+/*! Splits interleaved 8-bit pixels (RGBRGB...) into planes (RR...GG...BB...)
+ *  of 16-bit samples. First `planes` of the `channels` samples of each pixel are
+ *  kept, the rest (alpha) is dropped. Global work size is (width, height).
+ */
+__kernel void
+deinterleave8(__global uchar* in, __global ushort* out, int width, int height, int channels, int planes)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    __global uchar* pixel = in + (y * width + x) * channels;
+    
+    for (int c = 0; c < planes; c++)
+        out[(c * height + y) * width + x] = pixel[c];
+}
+
+/*! Same as deinterleave8, for 16-bit pixels.
+ */
+__kernel void
+deinterleave16(__global ushort* in, __global ushort* out, int width, int height, int channels, int planes)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    __global ushort* pixel = in + (y * width + x) * channels;
+    
+    for (int c = 0; c < planes; c++)
+        out[(c * height + y) * width + x] = pixel[c];
+}
+
+/*! Joins planes of 16-bit samples back into interleaved 8-bit pixels.
+ *  Samples above 255 saturate. Global work size is (width, height).
+ */
+__kernel void
+interleave8(__global ushort* in, __global uchar* out, int width, int height, int planes)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    __global uchar* pixel = out + (y * width + x) * planes;
+    
+    for (int c = 0; c < planes; c++)
+        pixel[c] = convert_uchar_sat(in[(c * height + y) * width + x]);
+}
+
+/*! Joins planes of 16-bit samples back into interleaved 16-bit pixels.
+ */
+__kernel void
+interleave16(__global ushort* in, __global ushort* out, int width, int height, int planes)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    __global ushort* pixel = out + (y * width + x) * planes;
+    
+    for (int c = 0; c < planes; c++)
+        pixel[c] = in[(c * height + y) * width + x];
+}
+
+/*! Valid 2D convolution of all planes in one launch. Global work size is
+ *  (width, height, planes), get_global_id(2) selects the plane.
+ *
+ *  Unlike convolve2d, weights are signed, sum is kept in 32 bits (enough for
+ *  16-bit samples and kernels up to 16x16) and result saturates to
+ *  [0, max_value] instead of wrapping around.
+ */
+__kernel void
+convolve2d_planar(__global ushort* in, __global ushort* out, __constant char* conv_kernel,
+                  int in_width, int in_height, int width, int height, int kernel_size, int max_value)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int c = get_global_id(2);
+    
+    __global ushort* plane = in + c * in_width * in_height;
+    
+    int sum = 0;
+    for (int yy = 0; yy < kernel_size; yy++) {
+        __global ushort* row = plane + (y + yy) * in_width + x;
+        __constant char* weights = conv_kernel + yy * kernel_size;
+        
+        for (int xx = 0; xx < kernel_size; xx++)
+            sum += weights[xx] * row[xx];
+    }
+    
+    out[(c * height + y) * width + x] = (ushort)clamp(sum, 0, max_value);
+}
+
+/*! Same as nms, for all planes of 16-bit samples in one launch. Global work
+ *  size is (blocks_x, blocks_y, planes). Maxima are marked with mark.
+ */
+__kernel void
+nms_planar(__global ushort* image, __global ushort* maxima, unsigned int W, unsigned int H, int n, int mark)
+{
+    unsigned int u = get_global_id(0);
+    unsigned int v = get_global_id(1);
+    
+    image += get_global_id(2) * W * H;
+    maxima += get_global_id(2) * W * H;
+    
+    unsigned int i = n + u * (n + 1);
+    unsigned int j = n + v * (n + 1);
+    
+    unsigned int mi = i, mj = j;
+    
+    for (unsigned int i2 = i; i2 <= min (i + n, W - 1); i2++)
+        for (unsigned int j2 = j; j2 <= min (j + n, H - 1); j2++)
+            if (image[j2*W + i2] > image[mj*W + mi]) {
+                mi = i2;
+                mj = j2;
+            }
+    
+    for (unsigned int i2 = mi - n; i2 <= min (mi + n, W - 1); i2++)
+        for (unsigned int j2 = mj - n; j2 <= min (mj + n, H - 1); j2++)
+            if (image[j2*W + i2] > image[mj*W + mi])
+                return;
+    
+    maxima[mj*W + mi] = mark;
+}
+
+/*! Sobel gradients of 8-bit image. Output has the same size as input (border
+ *  pixels are repeated), gradients are in [-1020, 1020].
+ */
+__kernel void
+sobel3x3(__global uchar* in, __global short* gx, __global short* gy, int width, int height)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    const int left = max(x - 1, 0);
+    const int right = min(x + 1, width - 1);
+    
+    __global uchar* above = in + max(y - 1, 0) * width;
+    __global uchar* row = in + y * width;
+    __global uchar* below = in + min(y + 1, height - 1) * width;
+    
+    gx[y * width + x] = (above[right] + 2 * row[right] + below[right]) - (above[left] + 2 * row[left] + below[left]);
+    gy[y * width + x] = (below[left] + 2 * below[x] + below[right]) - (above[left] + 2 * above[x] + above[right]);
+}
+
+/*! Harris corner response det(M) - k * trace(M)^2 of the structure tensor M,
+ *  summed over 3x3 binomial window. Gradients are normalized to [-127.5, 127.5]
+ *  first, so response does not depend on the gradient operator scale.
+ */
+__kernel void
+harris(__global short* gx, __global short* gy, __global float* response, int width, int height, float k)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    float sxx = 0.0f, syy = 0.0f, sxy = 0.0f;
+    
+    for (int yy = -1; yy <= 1; yy++)
+        for (int xx = -1; xx <= 1; xx++) {
+            const int index = clamp(y + yy, 0, height - 1) * width + clamp(x + xx, 0, width - 1);
+            const float weight = (2 - abs(xx)) * (2 - abs(yy)) / 16.0f;
+            const float dx = gx[index] / 8.0f;
+            const float dy = gy[index] / 8.0f;
+            
+            sxx += weight * dx * dx;
+            syy += weight * dy * dy;
+            sxy += weight * dx * dy;
+        }
+    
+    const float trace = sxx + syy;
+    response[y * width + x] = sxx * syy - sxy * sxy - k * trace * trace;
+}
+
+#ifdef cl_khr_global_int32_base_atomics
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+#endif
+
+/*! Keypoint found by nms_minmax, same layout as seminar::Keypoint.
+ */
+typedef struct {
+    int x;
+    int y;
+    int type;       /* 1 for maximum, -1 for minimum */
+    float score;
+} keypoint_t;
+
+/* Returns 1 if no value in (2n+1)x(2n+1) neighbourhood is larger (sign = 1)
+ * or smaller (sign = -1) than the value at (ci, cj)
+ */
+int is_extremum(__global float* response, int W, int ci, int cj, int n, float sign)
+{
+    const float value = sign * response[cj * W + ci];
+    
+    for (int j2 = cj - n; j2 <= cj + n; j2++)
+        for (int i2 = ci - n; i2 <= ci + n; i2++)
+            if (sign * response[j2 * W + i2] > value)
+                return 0;
+    
+    return 1;
+}
+
+/* Appends keypoint to the list. Keypoints over capacity are counted but not stored. */
+void emit_keypoint(__global keypoint_t* keypoints, __global uint* count, unsigned int capacity,
+                   int x, int y, int type, float score)
+{
+    const uint index = atomic_inc(count);
+    
+    if (index < capacity) {
+        keypoints[index].x = x;
+        keypoints[index].y = y;
+        keypoints[index].type = type;
+        keypoints[index].score = score;
+    }
+}
+
+/*! NMS for maxima and minima at once, as in libviso2 (matcher.cpp): each work
+ *  item searches its (n+1)x(n+1) block for both extrema and verifies each
+ *  against its (2n+1)x(2n+1) neighbourhood. Maxima above threshold and minima
+ *  below -threshold are appended to a compact list (in no particular order).
+ *
+ *  Blocks start margin pixels from the border, margin must be at least n.
+ *  Global work size is the number of blocks, rounded up is fine.
+ */
+__kernel void
+nms_minmax(__global float* response, __global keypoint_t* keypoints, __global uint* count, unsigned int capacity,
+           int W, int H, int n, int margin, float threshold)
+{
+    const int i = margin + get_global_id(0) * (n + 1);
+    const int j = margin + get_global_id(1) * (n + 1);
+    
+    if (i >= W - margin || j >= H - margin)
+        return;
+    
+    const int i_end = min(i + n, W - margin - 1);
+    const int j_end = min(j + n, H - margin - 1);
+    
+    int max_i = i, max_j = j, min_i = i, min_j = j;
+    float max_value = response[j * W + i], min_value = max_value;
+    
+    for (int j2 = j; j2 <= j_end; j2++)
+        for (int i2 = i; i2 <= i_end; i2++) {
+            const float value = response[j2 * W + i2];
+            
+            if (value > max_value) {
+                max_value = value;
+                max_i = i2;
+                max_j = j2;
+            } else if (value < min_value) {
+                min_value = value;
+                min_i = i2;
+                min_j = j2;
+            }
+        }
+    
+    if (max_value > threshold && is_extremum(response, W, max_i, max_j, n, 1.0f))
+        emit_keypoint(keypoints, count, capacity, max_i, max_j, 1, max_value);
+    
+    if (min_value < -threshold && is_extremum(response, W, min_i, min_j, n, -1.0f))
+        emit_keypoint(keypoints, count, capacity, min_i, min_j, -1, min_value);
+}
+
+/*! Sample offsets (x, y) of descriptors, same as pattern in Matcher.cpp.
+ */
+__constant char descriptor_pattern[64] = {
+    -4, -4,  -2, -4,   0, -4,   2, -4,   4, -4,
+    -4, -2,  -2, -2,   0, -2,   2, -2,   4, -2,
+    -4,  0,  -2,  0,   0,  0,   2,  0,   4,  0,
+    -4,  2,  -2,  2,   0,  2,   2,  2,   4,  2,
+    -4,  4,  -2,  4,   0,  4,   2,  4,   4,  4,
+    -1, -1,   1, -1,  -1,  1,   1,  1,   0, -3,  -3,  0,   3,  0
+};
+
+/*! 32-byte descriptor of each keypoint: 32 samples around it (hamming = 0),
+ *  or 256 comparisons of pairs of those samples (hamming = 1). Global work
+ *  size is the number of keypoints.
+ */
+__kernel void
+describe(__global uchar* image, int width, int height, __global keypoint_t* keypoints, int count,
+         int hamming, __global uchar* descriptors)
+{
+    const int k = get_global_id(0);
+    
+    if (k >= count)
+        return;
+    
+    uchar samples[32];
+    
+    for (int i = 0; i < 32; i++) {
+        const int x = clamp(keypoints[k].x + descriptor_pattern[2 * i], 0, width - 1);
+        const int y = clamp(keypoints[k].y + descriptor_pattern[2 * i + 1], 0, height - 1);
+        samples[i] = image[y * width + x];
+    }
+    
+    __global uchar* out = descriptors + k * 32;
+    
+    if (!hamming) {
+        for (int i = 0; i < 32; i++)
+            out[i] = samples[i];
+        return;
+    }
+    
+    /* Bit b of byte 4r + p/8 compares sample p with sample p + 1 + 4r (mod 32) */
+    for (int byte = 0; byte < 32; byte++) {
+        const int r = byte / 4;
+        uint bits = 0;
+        
+        for (int bit = 0; bit < 8; bit++) {
+            const int p = (byte % 4) * 8 + bit;
+            bits |= (samples[p] < samples[(p + 1 + 4 * r) % 32]) << bit;
+        }
+        
+        out[byte] = bits;
+    }
+}
+
+/* Number of set bits (popcount is OpenCL 1.2 only) */
+uint count_bits(uint v)
+{
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+/*! Nearest train descriptor of each query descriptor, by brute force.
+ *
+ *  Work group loads a tile of train descriptors (one per work item) and their
+ *  positions into local memory, then each work item compares its query
+ *  descriptor with the whole tile. If radius > 0, train keypoints further
+ *  than radius in either direction are skipped. Of equally distant train
+ *  descriptors, the one with the lowest index wins. Writes (train index,
+ *  distance) per query, (-1, INT_MAX) if nothing is found.
+ *
+ *  Global work size is query count rounded up to the work group size, tile
+ *  must hold 32 bytes and tile_pos 2 ints per work item.
+ */
+__kernel void
+match_descriptors(__global uint* query, __global keypoint_t* query_keypoints, int query_count,
+                  __global uint* train, __global keypoint_t* train_keypoints, int train_count,
+                  int hamming, int radius, __global int* matches, __local uint* tile, __local int* tile_pos)
+{
+    const int q = get_global_id(0);
+    const int l = get_local_id(0);
+    const int group_size = get_local_size(0);
+    const int active = q < query_count;
+    
+    uint descriptor[8];
+    int x = 0, y = 0;
+    
+    if (active) {
+        for (int w = 0; w < 8; w++)
+            descriptor[w] = query[q * 8 + w];
+        x = query_keypoints[q].x;
+        y = query_keypoints[q].y;
+    }
+    
+    int best = -1, best_distance = INT_MAX;
+    
+    for (int base = 0; base < train_count; base += group_size) {
+        const int t = base + l;
+        
+        if (t < train_count) {
+            for (int w = 0; w < 8; w++)
+                tile[l * 8 + w] = train[t * 8 + w];
+            tile_pos[2 * l] = train_keypoints[t].x;
+            tile_pos[2 * l + 1] = train_keypoints[t].y;
+        }
+        
+        barrier(CLK_LOCAL_MEM_FENCE);
+        
+        const int tile_count = min(group_size, train_count - base);
+        
+        for (int i = 0; active && i < tile_count; i++) {
+            if (radius > 0 && (abs(tile_pos[2 * i] - x) > radius || abs(tile_pos[2 * i + 1] - y) > radius))
+                continue;
+            
+            uint distance = 0;
+            
+            if (hamming) {
+                for (int w = 0; w < 8; w++)
+                    distance += count_bits(descriptor[w] ^ tile[i * 8 + w]);
+            } else {
+                for (int w = 0; w < 8; w++) {
+                    const uchar4 d = abs_diff(as_uchar4(descriptor[w]), as_uchar4(tile[i * 8 + w]));
+                    distance += d.x + d.y + d.z + d.w;
+                }
+            }
+            
+            if ((int)distance < best_distance) {
+                best_distance = distance;
+                best = base + i;
+            }
+        }
+        
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    if (active) {
+        matches[2 * q] = best;
+        matches[2 * q + 1] = best_distance;
+    }
+}
+
+/*! First pass of integral image: prefix sums of each row. Table has
+ *  (width + 1) x (height + 1) entries, entry (x, y) holds the sum of pixels
+ *  (or their squares, if square = 1) above and to the left of pixel (x, y).
+ *  This pass fills rows 1..height, integral_columns completes the table.
+ *  Sums are modulo 2^32, which is exact for differences of up to 2^32 - 1.
+ *
+ *  Each work group scans one row in chunks of its size (Hillis-Steele scan in
+ *  local memory), carrying the total of a chunk into the next one. Global work
+ *  size is (n, height) and local size (n, 1), scan holds n uints.
+ */
+__kernel void
+integral_rows(__global uchar* in, __global uint* table, int width, int height, int square, __local uint* scan)
+{
+    const int l = get_local_id(0);
+    const int n = get_local_size(0);
+    const int y = get_global_id(1);
+    
+    __global uchar* row = in + y * width;
+    __global uint* out = table + (y + 1) * (width + 1);
+    
+    if (l == 0)
+        out[0] = 0;
+    
+    uint carry = 0;
+    
+    for (int base = 0; base < width; base += n) {
+        const uint value = base + l < width ? row[base + l] : 0;
+        scan[l] = square ? value * value : value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        
+        for (int offset = 1; offset < n; offset *= 2) {
+            const uint left = l >= offset ? scan[l - offset] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            scan[l] += left;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        
+        if (base + l < width)
+            out[base + l + 1] = carry + scan[l];
+        
+        carry += scan[n - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+/*! Second pass of integral image: prefix sums of each column of the table
+ *  written by integral_rows, also clears row 0. Global work size is width + 1,
+ *  neighbouring work items access neighbouring entries.
+ */
+__kernel void
+integral_columns(__global uint* table, int width, int height)
+{
+    const int x = get_global_id(0);
+    
+    if (x > width)
+        return;
+    
+    const int pitch = width + 1;
+    uint sum = 0;
+    
+    table[x] = 0;
+    
+    for (int y = 1; y <= height; y++) {
+        sum += table[y * pitch + x];
+        table[y * pitch + x] = sum;
+    }
+}
+
+/* Sum of window x window pixels with top left corner (x, y), four table reads */
+uint window_sum(__global uint* table, int pitch, int x, int y, int window)
+{
+    return table[(y + window) * pitch + x + window] - table[y * pitch + x + window]
+         - table[(y + window) * pitch + x] + table[y * pitch + x];
+}
+
+/*! Valid box filter (rounded mean of window x window pixels) from integral
+ *  image of in_width wide image. Cost does not depend on window size.
+ *  Global work size is (width, height) of the output.
+ */
+__kernel void
+box_filter(__global uint* table, __global uchar* out, int in_width, int width, int height, int window)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    const uint area = window * window;
+    out[y * width + x] = (window_sum(table, in_width + 1, x, y, window) + area / 2) / area;
+}
+
+/*! Valid local mean and variance of window x window pixels from integral
+ *  images of pixels and their squares. Global work size is (width, height)
+ *  of the output.
+ */
+__kernel void
+mean_variance(__global uint* table, __global uint* sq_table, __global float* mean, __global float* variance,
+              int in_width, int width, int height, int window)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    const ulong area = window * window;
+    const ulong sum = window_sum(table, in_width + 1, x, y, window);
+    const ulong sq_sum = window_sum(sq_table, in_width + 1, x, y, window);
+    
+    /* area^2 * variance = area * sum of squares - sum^2, exact in 64 bits */
+    mean[y * width + x] = (float)sum / (float)area;
+    variance[y * width + x] = (float)(area * sq_sum - sum * sum) / (float)(area * area);
+}
+
+/* Sorts n values with Knuth's merge exchange (Batcher's odd-even merge) network.
+ * Comparisons do not depend on the data, so for constant n loops unroll into a
+ * fixed sequence of min/max operations.
+ */
+void sort_network(uchar* v, const int n)
+{
+    int t = 0;
+    while ((1 << t) < n)
+        t++;
+    
+    for (int p = 1 << (t - 1); p > 0; p >>= 1) {
+        int q = 1 << (t - 1), r = 0, d = p;
+        
+        while (1) {
+            for (int i = 0; i < n - d; i++)
+                if ((i & p) == r) {
+                    const uchar a = v[i], b = v[i + d];
+                    v[i] = min(a, b);
+                    v[i + d] = max(a, b);
+                }
+            
+            if (q == p)
+                break;
+            
+            d = q - p;
+            q >>= 1;
+            r = p;
+        }
+    }
+}
+
+/*! Valid 3x3 rank filter: rank-th smallest value of each window (4 is the
+ *  median). Same buffer conventions as convolve2d, global work size is
+ *  (width, height) of the output.
+ */
+__kernel void
+rank3x3(__global uchar* in, __global uchar* out, int in_width, int width, int height, int rank)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    uchar v[9];
+    for (int yy = 0; yy < 3; yy++)
+        for (int xx = 0; xx < 3; xx++)
+            v[yy * 3 + xx] = in[(y + yy) * in_width + x + xx];
+    
+    sort_network(v, 9);
+    out[y * width + x] = v[rank];
+}
+
+/*! Valid 5x5 rank filter, see rank3x3 (12 is the median).
+ */
+__kernel void
+rank5x5(__global uchar* in, __global uchar* out, int in_width, int width, int height, int rank)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    
+    if (x >= width || y >= height)
+        return;
+    
+    uchar v[25];
+    for (int yy = 0; yy < 5; yy++)
+        for (int xx = 0; xx < 5; xx++)
+            v[yy * 5 + xx] = in[(y + yy) * in_width + x + xx];
+    
+    sort_network(v, 25);
+    out[y * width + x] = v[rank];
+}
+
+/* Running max of window 2n+1 (van Herk / Gil-Werman) over one segment of 2n+1
+ * outputs starting at first, values count apart. See running_max_rows.
+ */
+void running_max_segment(__global uchar* in, __global uchar* out, int first, int count, int stride, int n)
+{
+    const int window = 2 * n + 1;
+    
+    /* Suffix max of the segment in coordinates padded by n (padding is 0) */
+    uchar suffix = 0;
+    for (int t = window - 1; t >= 0; t--) {
+        const int p = first + t;
+        suffix = max(suffix, (p >= n && p - n < count) ? in[(p - n) * stride] : (uchar)0);
+        if (first + t < count)
+            out[(first + t) * stride] = suffix;
+    }
+    
+    /* Prefix max of the next segment */
+    uchar prefix = 0;
+    for (int t = 1; t < window; t++) {
+        const int p = first + window + t - 1;
+        prefix = max(prefix, (p >= n && p - n < count) ? in[(p - n) * stride] : (uchar)0);
+        if (first + t < count)
+            out[(first + t) * stride] = max(out[(first + t) * stride], prefix);
+    }
+}
+
+/*! Horizontal pass of separable dilation: each output is the max of the 2n+1
+ *  pixels centered at it (pixels outside of the image count as 0), about 3
+ *  comparisons per pixel whatever n is. Work item handles 2n+1 consecutive
+ *  outputs, global work size is (ceil(width / (2n+1)), height).
+ */
+__kernel void
+running_max_rows(__global uchar* in, __global uchar* out, int width, int height, int n)
+{
+    const int first = get_global_id(0) * (2 * n + 1);
+    const int y = get_global_id(1);
+    
+    if (first >= width || y >= height)
+        return;
+    
+    running_max_segment(in + y * width, out + y * width, first, width, 1, n);
+}
+
+/*! Vertical pass of separable dilation, see running_max_rows. Neighbouring
+ *  work items handle neighbouring columns, global work size is
+ *  (width, ceil(height / (2n+1))).
+ */
+__kernel void
+running_max_columns(__global uchar* in, __global uchar* out, int width, int height, int n)
+{
+    const int x = get_global_id(0);
+    const int first = get_global_id(1) * (2 * n + 1);
+    
+    if (x >= width || first >= height)
+        return;
+    
+    running_max_segment(in + x, out + x, first, height, width, n);
+}
+
+/*! Last pass of separable nms: maximum of each (n+1)x(n+1) block (first one
+ *  found, as in nms) is marked if it equals the dilated image, that is if
+ *  nothing in its (2n+1)x(2n+1) neighbourhood is larger. Blocks are clamped
+ *  to the image. Global work size is the same as for nms.
+ */
+__kernel void
+nms_dilated(__global uchar* image, __global uchar* dilated, __global uchar* maxima, unsigned int W, unsigned int H, int n)
+{
+    unsigned int u = get_global_id(0);
+    unsigned int v = get_global_id(1);
+    
+    unsigned int i = n + u * (n + 1);
+    unsigned int j = n + v * (n + 1);
+    
+    unsigned int mi = i, mj = j;
+    
+    for (unsigned int i2 = i; i2 <= min (i + n, W - 1); i2++)
+        for (unsigned int j2 = j; j2 <= min (j + n, H - 1); j2++)
+            if (image[j2*W + i2] > image[mj*W + mi]) {
+                mi = i2;
+                mj = j2;
+            }
+    
+    if (image[mj*W + mi] == dilated[mj*W + mi])
+        maxima[mj*W + mi] = 255;
+}
@@ -0,0 +1,219 @@
+//
+//  CommandList.cpp
+//  OCLW
+//
+
+#include <algorithm>
+
+#include "CommandList.h"
+#include "Controller.h"
+#include "Exception.h"
+
+namespace oclw {
+
+    CommandList::CommandList (Controller* controller) : _controller (*controller), _bound_slots (0), _validated (false) {
+    }
+    
+    unsigned int CommandList::addSlot (size_t value_size) {
+        _slots.push_back(Slot());
+        _slots.back().value.resize(value_size);
+        return _slots.size() - 1;
+    }
+    
+    void CommandList::bindSlot (unsigned int slot) {
+        if (!_slots[slot].bound) {
+            _slots[slot].bound = true;
+            _bound_slots++;
+        }
+    }
+    
+    CommandList::Buffer CommandList::buffer () {
+        Buffer buffer;
+        buffer._slot = addSlot(0);
+        return buffer;
+    }
+    
+    CommandList::Pointer CommandList::pointer () {
+        Pointer pointer;
+        pointer._slot = addSlot(0);
+        return pointer;
+    }
+    
+    void CommandList::set (const Buffer& buffer, MemoryBuffer& memoryBuffer) {
+        Slot& slot = _slots[buffer._slot];
+        
+        if (memoryBuffer.size() < slot.required_size)
+            throw Exception("Memory buffer is smaller than transfers recorded for it.");
+        
+        slot.buffer = &memoryBuffer;
+        bindSlot(buffer._slot);
+    }
+    
+    void CommandList::set (const Pointer& pointer, const void* data) {
+        _slots[pointer._slot].pointer = const_cast<void*>(data);
+        bindSlot(pointer._slot);
+    }
+    
+    CommandList::Operand CommandList::operand (const MemoryBuffer& memoryBuffer, size_t size) {
+        if (memoryBuffer.size() < size)
+            throw Exception("Transfer is larger than memory buffer.");
+        
+        Operand operand;
+        operand.kind = Operand::BUFFER;
+        operand.buffer = const_cast<MemoryBuffer*>(&memoryBuffer);
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::operand (const Buffer& buffer, size_t size) {
+        Slot& slot = _slots[buffer._slot];
+        slot.required_size = std::max(slot.required_size, size);
+        
+        if (slot.bound && slot.buffer->size() < size)
+            throw Exception("Transfer is larger than memory buffer.");
+        
+        Operand operand;
+        operand.kind = Operand::BUFFER_SLOT;
+        operand.slot = buffer._slot;
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::operand (const void* pointer) {
+        Operand operand;
+        operand.kind = Operand::POINTER;
+        operand.pointer = const_cast<void*>(pointer);
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::operand (const Pointer& pointer) {
+        Operand operand;
+        operand.kind = Operand::POINTER_SLOT;
+        operand.slot = pointer._slot;
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::argument (const MemoryBuffer& memoryBuffer) {
+        Operand operand;
+        operand.kind = Operand::BUFFER;
+        operand.buffer = const_cast<MemoryBuffer*>(&memoryBuffer);
+        operand.size = sizeof(cl_mem);
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::argument (MemoryBuffer* memoryBuffer) {
+        return argument(*memoryBuffer);
+    }
+    
+    CommandList::Operand CommandList::argument (const Buffer& buffer) {
+        Operand operand;
+        operand.kind = Operand::BUFFER_SLOT;
+        operand.slot = buffer._slot;
+        operand.size = sizeof(cl_mem);
+        return operand;
+    }
+    
+    CommandList::Operand CommandList::argument (const Local& local) {
+        Operand operand;
+        operand.kind = Operand::LOCAL;
+        operand.size = local.size;
+        return operand;
+    }
+    
+    void CommandList::record (const Command& command) {
+        _commands.push_back(command);
+        _validated = false;
+    }
+    
+    void CommandList::clear () {
+        _commands.clear();
+        _validated = false;
+        
+        for (size_t i = 0; i < _slots.size(); i++)
+            _slots[i].required_size = 0;
+    }
+    
+    void CommandList::validate () {
+        for (size_t i = 0; i < _commands.size(); i++) {
+            const Command& command = _commands[i];
+            
+            if (command.type != Command::LAUNCH)
+                continue;
+            
+            if (command.arguments.size() != command.kernel->_arguments.size())
+                throw Exception("Number of kernel arguments does not match kernel definition.");
+            
+            for (size_t a = 0; a < command.arguments.size(); a++) {
+                const Operand& argument = command.arguments[a];
+                cl_uint address = CL_KERNEL_ARG_ADDRESS_PRIVATE;
+                
+                if (argument.kind == Operand::BUFFER || argument.kind == Operand::BUFFER_SLOT)
+                    address = CL_KERNEL_ARG_ADDRESS_GLOBAL;
+                else if (argument.kind == Operand::LOCAL)
+                    address = CL_KERNEL_ARG_ADDRESS_LOCAL;
+                
+                command.kernel->checkArgument(a, address, argument.size);
+            }
+        }
+        
+        _validated = true;
+    }
+    
+    MemoryBuffer& CommandList::resolve (const Operand& buffer) const {
+        return buffer.kind == Operand::BUFFER ? *buffer.buffer : *_slots[buffer.slot].buffer;
+    }
+    
+    void* CommandList::resolvePointer (const Operand& host) const {
+        return host.kind == Operand::POINTER ? host.pointer : _slots[host.slot].pointer;
+    }
+    
+    void CommandList::replay (cl_event* event) {
+        if (_bound_slots != _slots.size())
+            throw Exception("Not all placeholders of command list have a value.");
+        
+        if (!_validated)
+            validate();
+        
+        for (size_t i = 0; i < _commands.size(); i++) {
+            const Command& command = _commands[i];
+            cl_event* done = i + 1 == _commands.size() ? event : NULL;
+            
+            switch (command.type) {
+                case Command::WRITE:
+                    resolve(command.buffer).writeDataAsync(resolvePointer(command.host), command.size, done);
+                    break;
+                
+                case Command::READ:
+                    resolve(command.buffer).readDataAsync(resolvePointer(command.host), command.size, done);
+                    break;
+                
+                case Command::LAUNCH:
+                    for (size_t a = 0; a < command.arguments.size(); a++) {
+                        const Operand& argument = command.arguments[a];
+                        
+                        /* Unchanged values are skipped by Kernel::setArgument, buffers are always set */
+                        switch (argument.kind) {
+                            case Operand::BUFFER:
+                            case Operand::BUFFER_SLOT:
+                                command.kernel->setMemoryArgument(a, resolve(argument).id());
+                                break;
+                            case Operand::SCALAR_SLOT:
+                                command.kernel->setArgument(a, argument.size, &_slots[argument.slot].value[0]);
+                                break;
+                            case Operand::LOCAL:
+                                command.kernel->setArgument(a, argument.size, NULL);
+                                break;
+                            default:
+                                command.kernel->setArgument(a, argument.size, &argument.value[0]);
+                        }
+                    }
+                    
+                    if (command.has_local)
+                        command.kernel->executeAsync(command.global, command.local, done);
+                    else
+                        command.kernel->executeAsync(command.global, done);
+                    break;
+            }
+        }
+        
+        _controller.flush();
+    }
+}
@@ -0,0 +1,277 @@
+//
+//  CommandList.h
+//  OCLW
+//
+
+#ifndef OCLW_CommandList_h
+#define OCLW_CommandList_h
+
+#include "OpenCL.h"
+#include "Kernel.h"
+#include "MemoryBuffer.h"
+#include <vector>
+#include <type_traits>
+#include <string.h>
+
+namespace oclw {
+    class Controller;
+    
+    /*! Recorded sequence of transfers and kernel launches that can be replayed
+     *  with one call.
+     *
+     *  Buffers, host pointers and scalar arguments that change from replay to
+     *  replay are recorded as placeholders and given a value with set() before
+     *  replay(). Everything else is fixed at record time. Sequence is checked
+     *  against kernel definitions once, on first replay, so replay itself only
+     *  enqueues commands and flushes the queue once:
+     *
+     *  \code
+     *  oclw::CommandList frame (controller);
+     *  oclw::CommandList::Pointer src = frame.pointer();
+     *  oclw::CommandList::Pointer dst = frame.pointer();
+     *  oclw::CommandList::Scalar<int> threshold = frame.scalar<int>();
+     *
+     *  frame.write(*input, src, size);
+     *  frame.launch(kernel, oclw::Kernel::NDRange::range2D(w, h), *input, *output, w, threshold);
+     *  frame.read(*output, dst, size);
+     *
+     *  frame.set(src, image);
+     *  frame.set(dst, result);
+     *  frame.set(threshold, 20);
+     *  frame.replay();
+     *  controller->finish();
+     *  \endcode
+     *
+     *  Work sizes and transfer sizes are fixed; when they change, clear() and
+     *  record the sequence again. Placeholders and their values survive clear().
+     */
+    class CommandList {
+    public:
+        /*! Placeholder for a MemoryBuffer.
+         */
+        class Buffer {
+            friend class CommandList;
+            unsigned int _slot;
+        };
+        
+        /*! Placeholder for a host pointer (transfer source or destination).
+         */
+        class Pointer {
+            friend class CommandList;
+            unsigned int _slot;
+        };
+        
+        /*! Placeholder for a scalar kernel argument of type T.
+         */
+        template <typename T>
+        class Scalar {
+            friend class CommandList;
+            unsigned int _slot;
+        };
+    
+    private:
+        /* Value given to a placeholder */
+        struct Slot {
+            MemoryBuffer* buffer;
+            void* pointer;
+            std::vector<unsigned char> value;
+            size_t required_size;               /* Largest transfer recorded for buffer */
+            bool bound;
+            
+            Slot () : buffer (NULL), pointer (NULL), required_size (0), bound (false) {}
+        };
+        
+        /* Recorded kernel argument, transfer buffer or host pointer */
+        struct Operand {
+            enum Kind { VALUE, BUFFER, BUFFER_SLOT, POINTER, POINTER_SLOT, SCALAR_SLOT, LOCAL } kind;
+            unsigned int slot;
+            MemoryBuffer* buffer;
+            void* pointer;
+            size_t size;
+            std::vector<unsigned char> value;
+            
+            Operand () : kind (VALUE), slot (0), buffer (NULL), pointer (NULL), size (0) {}
+        };
+        
+        struct Command {
+            enum Type { WRITE, READ, LAUNCH } type;
+            Operand buffer;
+            Operand host;
+            size_t size;
+            
+            Kernel* kernel;
+            Kernel::NDRange global;
+            Kernel::NDRange local;
+            bool has_local;
+            std::vector<Operand> arguments;
+            
+            Command () : size (0), kernel (NULL), global (Kernel::NDRange::range1D(1)),
+                         local (Kernel::NDRange::range1D(1)), has_local (false) {}
+        };
+        
+        Controller& _controller;
+        std::vector<Slot> _slots;
+        std::vector<Command> _commands;
+        unsigned int _bound_slots;
+        bool _validated;
+        
+        CommandList (const CommandList&);
+        CommandList& operator= (const CommandList&);
+        
+        unsigned int addSlot (size_t value_size);
+        void bindSlot (unsigned int slot);
+        
+        Operand operand (const MemoryBuffer& memoryBuffer, size_t size);
+        Operand operand (const Buffer& buffer, size_t size);
+        Operand operand (const void* pointer);
+        Operand operand (const Pointer& pointer);
+        
+        Operand argument (const MemoryBuffer& memoryBuffer);
+        Operand argument (MemoryBuffer* memoryBuffer);
+        Operand argument (const Buffer& buffer);
+        Operand argument (const Local& local);
+        
+        template <typename T>
+        Operand argument (const Scalar<T>& scalar) {
+            Operand operand;
+            operand.kind = Operand::SCALAR_SLOT;
+            operand.slot = scalar._slot;
+            operand.size = sizeof(T);
+            return operand;
+        }
+        
+        template <typename T>
+        Operand argument (const T& value) {
+            static_assert(std::is_pod<T>::value && !std::is_pointer<T>::value,
+                          "Kernel argument must be a MemoryBuffer, Local, placeholder or a plain value.");
+            Operand operand;
+            operand.kind = Operand::VALUE;
+            operand.size = sizeof(T);
+            operand.value.assign((const unsigned char*)&value, (const unsigned char*)&value + sizeof(T));
+            return operand;
+        }
+        
+        void recordArguments (Command&) {}
+        
+        template <typename T, typename... Rest>
+        void recordArguments (Command& command, const T& value, const Rest&... rest) {
+            command.arguments.push_back(argument(value));
+            recordArguments(command, rest...);
+        }
+        
+        void record (const Command& command);
+        
+        /* Checks recorded launches against kernel definitions */
+        void validate ();
+        
+        MemoryBuffer& resolve (const Operand& buffer) const;
+        void* resolvePointer (const Operand& host) const;
+    
+    public:
+        CommandList (Controller* controller);
+        
+        /*! Creates buffer placeholder.
+         */
+        Buffer buffer ();
+        
+        /*! Creates host pointer placeholder.
+         */
+        Pointer pointer ();
+        
+        /*! Creates scalar argument placeholder.
+         */
+        template <typename T>
+        Scalar<T> scalar () {
+            static_assert(std::is_pod<T>::value && !std::is_pointer<T>::value, "Scalar must be a plain value.");
+            Scalar<T> scalar;
+            scalar._slot = addSlot(sizeof(T));
+            return scalar;
+        }
+        
+        /*! Gives value to a buffer placeholder. Buffer must be large enough for
+         *  all transfers recorded with the placeholder.
+         */
+        void set (const Buffer& buffer, MemoryBuffer& memoryBuffer);
+        
+        /*! Gives value to a host pointer placeholder.
+         */
+        void set (const Pointer& pointer, const void* data);
+        
+        /*! Gives value to a scalar argument placeholder.
+         */
+        template <typename T>
+        void set (const Scalar<T>& scalar, const typename std::common_type<T>::type& value) {
+            Slot& slot = _slots[scalar._slot];
+            memcpy(&slot.value[0], &value, sizeof(T));
+            bindSlot(scalar._slot);
+        }
+        
+        /*! Records transfer of size bytes from host to buffer.
+         *  Buffer is a MemoryBuffer or Buffer placeholder, data a pointer or Pointer placeholder.
+         */
+        template <typename B, typename P>
+        void write (const B& buffer, const P& data, size_t size) {
+            Command command;
+            command.type = Command::WRITE;
+            command.buffer = operand(buffer, size);
+            command.host = operand(data);
+            command.size = size;
+            record(command);
+        }
+        
+        /*! Records transfer of size bytes from buffer to host.
+         *  Buffer is a MemoryBuffer or Buffer placeholder, data a pointer or Pointer placeholder.
+         */
+        template <typename B, typename P>
+        void read (const B& buffer, const P& data, size_t size) {
+            Command command;
+            command.type = Command::READ;
+            command.buffer = operand(buffer, size);
+            command.host = operand(data);
+            command.size = size;
+            record(command);
+        }
+        
+        /*! Records kernel launch. Arguments are the same as for Kernel::bind(),
+         *  plus Buffer and Scalar placeholders.
+         */
+        template <typename... Args>
+        void launch (Kernel* kernel, const Kernel::NDRange& global_work_size, const Args&... args) {
+            Command command;
+            command.type = Command::LAUNCH;
+            command.kernel = kernel;
+            command.global = global_work_size;
+            recordArguments(command, args...);
+            record(command);
+        }
+        
+        /*! Records kernel launch with specified local work group size.
+         */
+        template <typename... Args>
+        void launch (Kernel* kernel, const Kernel::NDRange& global_work_size, const Kernel::NDRange& local_work_size,
+                     const Args&... args) {
+            Command command;
+            command.type = Command::LAUNCH;
+            command.kernel = kernel;
+            command.global = global_work_size;
+            command.local = local_work_size;
+            command.has_local = true;
+            recordArguments(command, args...);
+            record(command);
+        }
+        
+        /*! Removes recorded commands. Placeholders and their values are kept.
+         */
+        void clear ();
+        
+        /*! Enqueues recorded commands and submits them to the device, without waiting.
+         *  All placeholders must have a value.
+         *
+         *  \param event If not NULL, receives an event that completes with the last command.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void replay (cl_event* event = NULL);
+    };
+}
+
+#endif
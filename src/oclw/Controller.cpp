@@ -6,12 +6,16 @@
 //
 
 #include <iostream>
+#include <algorithm>
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "Controller.h"
 #include "MemoryBuffer.h"
 #include "Program.h"
 #include "Exception.h"
+#include "Trace.h"
 
 namespace oclw {
 
@@ -19,24 +23,72 @@ namespace oclw {
         std::cout << "OpenCL device:\n" << vendor << " " << name << std::endl;
         std::cout << "Compute units: " << compute_units << std::endl;
         std::cout << "Global memory size: " << global_mem_size / 1024 / 1024 << " MB" << std::endl;
+        std::cout << "Max memory allocation size: " << max_mem_alloc_size / 1024 / 1024 << " MB" << std::endl;
         std::cout << "Local memory size: " << local_mem_size / 1024 << " KB" << std::endl;
         std::cout << "Constant memory size: " << constant_mem_size / 1024 << " KB" << std::endl;
         std::cout << "Max work group size: " << max_work_group_size << " work-items" << std::endl;
         std::cout << "Max number of work items per dimension: [" << max_work_item_sizes[0] << ", "
                                               << max_work_item_sizes[1] << ", "
                                               << max_work_item_sizes[2] << "]" << std::endl;
+        std::cout << "Device type: " << (type & CL_DEVICE_TYPE_GPU ? "GPU" : type & CL_DEVICE_TYPE_CPU ? "CPU" : "accelerator")
+                  << ", local memory " << (local_mem_dedicated ? "dedicated" : "in global memory")
+                  << ", images " << (image_support ? "supported" : "not supported") << std::endl;
+        std::cout << "Preferred vector width: char" << preferred_vector_width_char
+                  << ", int" << preferred_vector_width_int << std::endl;
+        std::cout << "Global memory cache: " << global_mem_cache_size / 1024 << " KB, "
+                  << global_mem_cacheline_size << " byte lines" << std::endl;
+    }
+    
+    void Controller::MemoryReport::print () {
+        std::cout << "Live memory buffers: " << memory_buffers << std::endl;
+        std::cout << "Live programs: " << programs << ", kernels: " << kernels << std::endl;
+        std::cout << "Allocated device memory: " << allocated_bytes / 1024 << " KB (peak "
+                  << peak_allocated_bytes / 1024 << " KB)" << std::endl;
+    }
+    
+    /* Returns true if device supports OpenCL 1.2 or newer.
+     */
+    static bool deviceSupportsOpenCL12 (cl_device_id device) {
+        char version[128];
+        int major, minor;
+        
+        /* Format is "OpenCL <major>.<minor> <vendor specific>" */
+        if (clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), version, NULL) != CL_SUCCESS ||
+            sscanf(version, "OpenCL %d.%d", &major, &minor) != 2)
+            return false;
+        
+        return major > 1 || (major == 1 && minor >= 2);
     }
     
     static Controller* _instance = NULL;
+    static std::once_flag _instance_flag;
+    
+    struct Controller::ThreadQueue {
+        const Controller* controller;
+        cl_command_queue queue;
+        
+        ThreadQueue () : controller (NULL), queue (NULL) {}
+        
+        ~ThreadQueue () {
+            /* Queue of the thread that created controller is released with controller */
+            if (controller != NULL)
+                controller->releaseThreadQueue(queue);
+        }
+    };
+    
+    thread_local Controller::ThreadQueue Controller::_thread_queue;
     
     Controller* Controller::shared () {
-        if (_instance == NULL)
+        /* If constructor throws, next call tries again */
+        std::call_once(_instance_flag, [] () {
             _instance = new Controller ();
+        });
         
         return _instance;
     }
     
-    Controller::Controller () {
+    Controller::Controller ()
+        : _live_memory_buffers (0), _live_programs (0), _live_kernels (0), _allocated_bytes (0), _peak_allocated_bytes (0) {
         cl_int err;
         err = clGetPlatformIDs(1, &_platform, NULL);
         
@@ -53,30 +105,45 @@ namespace oclw {
         if (err != CL_SUCCESS)
             throw Exception("Could not find any comaptible computation device.");
         
+        _opencl12 = deviceSupportsOpenCL12(_device);
+        
         _context = clCreateContext(0, 1, &_device, NULL, NULL, &err);
         
         if (err != CL_SUCCESS)
             throw Exception("Could not create OpenCL context.");
         
-        _queue = clCreateCommandQueue(_context, _device, 0, &err);
+        /* Tracing needs device timestamps, which are only recorded by profiling queues */
+        Trace::enableFromEnvironment();
+        
+        _queue = clCreateCommandQueue(_context, _device, Trace::enabled() ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
         
         if (err != CL_SUCCESS)
             throw Exception("Could not create OpenCL command queue.");
+        
+        _thread_queue.queue = _queue;
     }
     
     Controller::~Controller () {
-        /* Delete allocated memory buffer objects
-         */
-        for (int i = 0; i < _memoryBuffers.size(); i++)
-            delete _memoryBuffers[i];
-        
-        /* Delete allocated program objects
-         */
-        for (int i = 0; i < _programs.size(); i++)
-            delete _programs[i];
+        for (int s = 0; s < shard_count; s++) {
+            /* Delete allocated memory buffer objects
+             */
+            for (int i = 0; i < _shards[s].memoryBuffers.size(); i++)
+                delete _shards[s].memoryBuffers[i];
+            
+            /* Delete allocated program objects
+             */
+            for (int i = 0; i < _shards[s].programs.size(); i++)
+                delete _shards[s].programs[i];
+        }
         
         /* Teardown Other stuff
          */
+        for (int i = 0; i < _queues.size(); i++) {
+            Trace::releaseQueue(_queues[i]);
+            clReleaseCommandQueue(_queues[i]);
+        }
+        
+        Trace::releaseQueue(_queue);
         clReleaseCommandQueue(_queue);
         clReleaseContext(_context);
     }
@@ -93,6 +160,8 @@ namespace oclw {
                 sizeof(info.compute_units), &info.compute_units, NULL);
         err |= clGetDeviceInfo(_device, CL_DEVICE_GLOBAL_MEM_SIZE, 
                 sizeof(info.global_mem_size), &info.global_mem_size, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, 
+                sizeof(info.max_mem_alloc_size), &info.max_mem_alloc_size, NULL);
         err |= clGetDeviceInfo(_device, CL_DEVICE_LOCAL_MEM_SIZE, 
                 sizeof(info.local_mem_size), &info.local_mem_size, NULL);
         err |= clGetDeviceInfo(_device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, 
@@ -102,36 +171,162 @@ namespace oclw {
         err |= clGetDeviceInfo(_device, CL_DEVICE_MAX_WORK_ITEM_SIZES, 
                 sizeof(info.max_work_item_sizes), &info.max_work_item_sizes, NULL);
         
+        cl_device_local_mem_type local_mem_type;
+        cl_bool image_support;
+        
+        err |= clGetDeviceInfo(_device, CL_DEVICE_TYPE, 
+                sizeof(info.type), &info.type, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR, 
+                sizeof(info.preferred_vector_width_char), &info.preferred_vector_width_char, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT, 
+                sizeof(info.preferred_vector_width_int), &info.preferred_vector_width_int, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, 
+                sizeof(info.global_mem_cache_size), &info.global_mem_cache_size, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, 
+                sizeof(info.global_mem_cacheline_size), &info.global_mem_cacheline_size, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_LOCAL_MEM_TYPE, 
+                sizeof(local_mem_type), &local_mem_type, NULL);
+        err |= clGetDeviceInfo(_device, CL_DEVICE_IMAGE_SUPPORT, 
+                sizeof(image_support), &image_support, NULL);
+        
+        info.local_mem_dedicated = local_mem_type == CL_LOCAL;
+        info.image_support = image_support == CL_TRUE;
+        
         if (err != CL_SUCCESS)
             throw Exception("Could not read device info.");
             
         return info;
     }
     
+    Controller::Shard& Controller::shard (const void* object) {
+        /* Low bits are the same for all objects due to alignment */
+        return _shards[((uintptr_t)object >> 4) % shard_count];
+    }
+    
     MemoryBuffer* Controller::createMemoryBuffer () {
         MemoryBuffer* memoryBuffer = new MemoryBuffer(*this);
-        _memoryBuffers.push_back(memoryBuffer);
+        
+        Shard& s = shard(memoryBuffer);
+        std::lock_guard<std::mutex> guard (s.lock);
+        s.memoryBuffers.push_back(memoryBuffer);
         return memoryBuffer;
     }
     
     MemoryBuffer* Controller::createMemoryBuffer (MemoryBuffer::AccessMode mode, size_t size, void* data) {
         MemoryBuffer* memoryBuffer = new MemoryBuffer(*this, mode, size, data);
-        _memoryBuffers.push_back(memoryBuffer);
+        
+        Shard& s = shard(memoryBuffer);
+        std::lock_guard<std::mutex> guard (s.lock);
+        s.memoryBuffers.push_back(memoryBuffer);
         return memoryBuffer;
     }
     
     Program* Controller::createProgramObject () {
         Program* program = new Program(*this);
-        _programs.push_back(program);
+        
+        Shard& s = shard(program);
+        std::lock_guard<std::mutex> guard (s.lock);
+        s.programs.push_back(program);
         return program;
     }
     
+    void Controller::release (MemoryBuffer* memoryBuffer) {
+        Shard& s = shard(memoryBuffer);
+        {
+            std::lock_guard<std::mutex> guard (s.lock);
+            std::vector<MemoryBuffer*>::iterator it = std::find(s.memoryBuffers.begin(), s.memoryBuffers.end(), memoryBuffer);
+            
+            if (it == s.memoryBuffers.end())
+                throw Exception("Memory buffer was not created by this controller.");
+            
+            s.memoryBuffers.erase(it);
+        }
+        
+        delete memoryBuffer;
+    }
+    
+    void Controller::release (Program* program) {
+        Shard& s = shard(program);
+        {
+            std::lock_guard<std::mutex> guard (s.lock);
+            std::vector<Program*>::iterator it = std::find(s.programs.begin(), s.programs.end(), program);
+            
+            if (it == s.programs.end())
+                throw Exception("Program was not created by this controller.");
+            
+            s.programs.erase(it);
+        }
+        
+        delete program;
+    }
+    
+    void Controller::trackAllocation (size_t size) {
+        size_t allocated = _allocated_bytes += size;
+        size_t peak = _peak_allocated_bytes;
+        
+        while (allocated > peak && !_peak_allocated_bytes.compare_exchange_weak(peak, allocated))
+            ;
+    }
+    
+    void Controller::trackRelease (size_t size) {
+        _allocated_bytes -= size;
+    }
+    
+    Controller::MemoryReport Controller::memoryReport () const {
+        MemoryReport report;
+        report.memory_buffers = _live_memory_buffers;
+        report.programs = _live_programs;
+        report.kernels = _live_kernels;
+        report.allocated_bytes = _allocated_bytes;
+        report.peak_allocated_bytes = _peak_allocated_bytes;
+        return report;
+    }
+    
+    cl_command_queue Controller::createThreadQueue () const {
+        cl_int err;
+        cl_command_queue queue = clCreateCommandQueue(_context, _device, Trace::enabled() ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not create OpenCL command queue.");
+        
+        std::lock_guard<std::mutex> guard (_queues_lock);
+        _queues.push_back(queue);
+        return queue;
+    }
+    
+    void Controller::releaseThreadQueue (cl_command_queue queue) const {
+        clFinish(queue);
+        
+        std::lock_guard<std::mutex> guard (_queues_lock);
+        _queues.erase(std::find(_queues.begin(), _queues.end(), queue));
+        Trace::releaseQueue(queue);
+        clReleaseCommandQueue(queue);
+    }
+    
+    void Controller::flush () {
+        clFlush(cmdQueue());
+    }
+    
+    void Controller::finish () {
+        TraceSpan span ("finish");
+        clFinish(cmdQueue());
+    }
+    
     cl_context Controller::context () const {
         return _context;
     }
     
     cl_command_queue Controller::cmdQueue () const {
-        return _queue;
+        if (_thread_queue.queue == NULL) {
+            _thread_queue.queue = createThreadQueue();
+            _thread_queue.controller = this;
+        }
+        
+        return _thread_queue.queue;
+    }
+    
+    bool Controller::supportsOpenCL12 () const {
+        return _opencl12;
     }
     
     cl_device_id Controller::device () const {
@@ -12,6 +12,8 @@
 #include "MemoryBuffer.h"
 #include <vector>
 #include <string>
+#include <mutex>
+#include <atomic>
 
 namespace oclw {
     class Program;
@@ -24,8 +26,21 @@ namespace oclw {
      *  
      *  Class is implemented as "singleton" so you can't instantiate it.
      *  Use shared() method to get a reference to the actual object.
+     *  
+     *  Controller can be used from several threads at once. Each thread
+     *  submits its commands to its own command queue (see cmdQueue()), so
+     *  threads never wait for each other's commands. Kernel objects hold
+     *  argument state and must not be shared between threads; use
+     *  Kernel::clone() to get an instance for each thread.
+     *  
+     *  Created objects live until the controller is destroyed, unless they
+     *  are released earlier with release() or owned by a Handle.
      */
     class Controller {
+        friend class MemoryBuffer;
+        friend class Program;
+        friend class Kernel;
+        
     public:
         /*! Device information container.
          *  
@@ -37,11 +52,33 @@ namespace oclw {
             char vendor[255];
             unsigned int compute_units;
             unsigned long global_mem_size;
+            unsigned long max_mem_alloc_size;
             unsigned long local_mem_size;
             unsigned long constant_mem_size;
             size_t max_work_group_size;
             size_t max_work_item_sizes[3];
             
+            cl_device_type type;                    /*!< CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU, ... */
+            unsigned int preferred_vector_width_char;
+            unsigned int preferred_vector_width_int;
+            unsigned long global_mem_cache_size;
+            unsigned int global_mem_cacheline_size;
+            bool local_mem_dedicated;               /*!< False if local memory is emulated in global memory. */
+            bool image_support;
+            
+            void print ();
+        };
+        
+        /*! Number and size of live objects, for finding leaks.
+         */
+        class MemoryReport {
+        public:
+            size_t memory_buffers;
+            size_t programs;
+            size_t kernels;
+            size_t allocated_bytes;
+            size_t peak_allocated_bytes;   /*!< High-water mark of allocated_bytes. */
+            
             void print ();
         };
         
@@ -50,22 +87,66 @@ namespace oclw {
         cl_device_id _device;
         cl_context _context;
         cl_command_queue _queue;
+        bool _opencl12;
         
         /* We are keeping list of object we allocate so we
          * can follow philosphy "Who allocated should also deallocate."
+         * Lists are split into shards, each with its own lock, so threads
+         * creating objects at the same time rarely wait for each other.
          */
-        std::vector<MemoryBuffer*> _memoryBuffers;
-        std::vector<Program*> _programs;
+        struct Shard {
+            std::mutex lock;
+            std::vector<MemoryBuffer*> memoryBuffers;
+            std::vector<Program*> programs;
+        };
+        
+        static const unsigned int shard_count = 16;
+        Shard _shards[shard_count];
+        
+        /* Command queues of threads other than the one that created controller */
+        mutable std::mutex _queues_lock;
+        mutable std::vector<cl_command_queue> _queues;
+        
+        /* Live object counters, updated by objects themselves */
+        std::atomic<size_t> _live_memory_buffers;
+        std::atomic<size_t> _live_programs;
+        std::atomic<size_t> _live_kernels;
+        std::atomic<size_t> _allocated_bytes;
+        std::atomic<size_t> _peak_allocated_bytes;
         
     private:
         /* Initializes OpenCL framework.
          */
         Controller ();
         
+        /* Returns shard in which object is kept.
+         */
+        Shard& shard (const void* object);
+        
+        /* Owner of the calling thread's command queue, releases it at thread exit.
+         */
+        struct ThreadQueue;
+        static thread_local ThreadQueue _thread_queue;
+        
+        /* Creates command queue for the calling thread.
+         */
+        cl_command_queue createThreadQueue () const;
+        
+        /* Waits for commands in queue of an exiting thread and releases it.
+         */
+        void releaseThreadQueue (cl_command_queue queue) const;
+        
+        /* Called by MemoryBuffer when device memory is allocated or released.
+         */
+        void trackAllocation (size_t size);
+        void trackRelease (size_t size);
+        
     public:
+        
         ~Controller ();
         
-        /*! Gets a reference to the singleton.
+        /*! Gets a reference to the singleton. Safe to call from any thread,
+         *  object is created only once.
          */
         static Controller* shared ();
         
@@ -90,9 +171,42 @@ namespace oclw {
          */
         Program* createProgramObject ();
         
+        /*! Deletes memory buffer object and frees its memory.
+         *  Object must have been created by this controller and must not be used afterwards.
+         */
+        void release (MemoryBuffer* memoryBuffer);
+        
+        /*! Deletes program object together with all its kernels.
+         *  Object must have been created by this controller and must not be used afterwards.
+         */
+        void release (Program* program);
+        
+        /*! Returns number and size of objects that are currently alive.
+         */
+        MemoryReport memoryReport () const;
+        
+        /*! Submits all commands enqueued by the calling thread to the device without waiting for them.
+         */
+        void flush ();
+        
+        /*! Blocks until all commands enqueued by the calling thread are completed.
+         */
+        void finish ();
+        
         cl_context context () const;
+        
+        /*! Returns command queue of the calling thread.
+         *  
+         *  Thread that created the controller uses its original queue. Other threads
+         *  get their own queue on first call, released when the thread exits.
+         *  Commands of different threads are not ordered with respect to each other.
+         */
         cl_command_queue cmdQueue () const;
         cl_device_id device () const;
+        
+        /*! Returns true if device supports OpenCL 1.2 or newer.
+         */
+        bool supportsOpenCL12 () const;
     };
 }
 
@@ -9,20 +9,25 @@
 #define OCLW_Exception_h
 
 #include <exception>
+#include <string>
 
 namespace oclw {
     
-    /*! Simple exception class.
+    /*! Simple exception class. Message is copied, so it can be built at run time
+     *  (for example, from a build log).
      */
     class Exception : public std::exception {
     private:
-        const char* _message;
+        std::string _message;
         
     public:
         Exception (const char* message) : _message (message) {}
+        Exception (const std::string& message) : _message (message) {}
+        
+        virtual ~Exception () throw() {}
         
         virtual const char* what() const throw() {
-            return _message;
+            return _message.c_str();
         }
     };
 }
@@ -0,0 +1,100 @@
+//
+//  Handle.h
+//  OCLW
+//
+
+#ifndef OCLW_Handle_h
+#define OCLW_Handle_h
+
+#include <stddef.h>
+
+#include "Controller.h"
+#include "MemoryBuffer.h"
+#include "Program.h"
+#include "Kernel.h"
+#include "Exception.h"
+
+namespace oclw {
+
+    /*! Owning handle of a MemoryBuffer, Program or Kernel object.
+     *
+     *  Objects created by Controller (and Program) live until the Controller is
+     *  destroyed unless released explicitly. Handle releases its object as soon as
+     *  the handle goes out of scope, so memory of long-running processes stays flat.
+     *  Handle can be moved, but not copied:
+     *
+     *  \code
+     *  oclw::Handle<oclw::MemoryBuffer> buffer (controller->createMemoryBuffer(oclw::MemoryBuffer::READ, size));
+     *  buffer->writeData(data, size);
+     *  \endcode
+     */
+    template <typename T>
+    class Handle {
+    private:
+        T* _object;
+
+        Handle (const Handle&);
+        Handle& operator= (const Handle&);
+
+        static void destroy (MemoryBuffer* memoryBuffer) {
+            Controller::shared()->release(memoryBuffer);
+        }
+
+        static void destroy (Program* program) {
+            Controller::shared()->release(program);
+        }
+
+        static void destroy (Kernel* kernel) {
+            kernel->program().release(kernel);
+        }
+
+    public:
+        Handle () : _object (NULL) {}
+        explicit Handle (T* object) : _object (object) {}
+
+        Handle (Handle&& other) : _object (other._object) {
+            other._object = NULL;
+        }
+
+        Handle& operator= (Handle&& other) {
+            if (this != &other) {
+                reset(other._object);
+                other._object = NULL;
+            }
+            return *this;
+        }
+
+        /* Release throws if the object is no longer known (e.g. it was released
+         * explicitly); a destructor must not throw, so that is ignored here.
+         */
+        ~Handle () {
+            try {
+                reset();
+            } catch (const Exception&) {
+                _object = NULL;
+            }
+        }
+
+        /*! Releases owned object (if any) and takes ownership of the given one.
+         */
+        void reset (T* object = NULL) {
+            if (_object != NULL)
+                destroy(_object);
+            _object = object;
+        }
+
+        /*! Gives up ownership without releasing the object.
+         */
+        T* release () {
+            T* object = _object;
+            _object = NULL;
+            return object;
+        }
+
+        T* get () const { return _object; }
+        T* operator-> () const { return _object; }
+        T& operator* () const { return *_object; }
+    };
+}
+
+#endif
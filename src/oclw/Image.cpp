@@ -0,0 +1,93 @@
+//
+//  Image.cpp
+//  OCLW
+//
+
+#include "Image.h"
+#include "Controller.h"
+#include "Exception.h"
+
+namespace oclw {
+
+    Image::Image (Controller* controller, size_t width, size_t height, size_t pixel_size)
+        : _controller (*controller), _width (width), _height (height), _pixel_size (pixel_size),
+          _host (width * height * pixel_size, 0), _host_valid (true), _device_valid (false), _upload (NULL) {}
+    
+    Image::~Image () {
+        waitForUpload();
+    }
+    
+    void Image::waitForUpload () {
+        if (_upload != NULL) {
+            clWaitForEvents(1, &_upload);
+            clReleaseEvent(_upload);
+            _upload = NULL;
+        }
+    }
+    
+    void Image::allocateDevice () {
+        if (_device.get() == NULL)
+            _device.reset(_controller.createMemoryBuffer(MemoryBuffer::READ_WRITE, size()));
+    }
+    
+    size_t Image::width () const {
+        return _width;
+    }
+    
+    size_t Image::height () const {
+        return _height;
+    }
+    
+    size_t Image::size () const {
+        return _host.size();
+    }
+    
+    uint8_t* Image::host (Access access) {
+        if (access != WRITE && !_host_valid) {
+            /* Blocking read also waits for kernels that write the buffer */
+            _device->readData(&_host[0], size());
+            _host_valid = true;
+        }
+        
+        if (access != READ) {
+            waitForUpload();
+            _host_valid = true;
+            _device_valid = false;
+        }
+        
+        return &_host[0];
+    }
+    
+    MemoryBuffer& Image::device (Access access) {
+        allocateDevice();
+        
+        if (access != WRITE && !_device_valid) {
+            waitForUpload();
+            _device->writeDataAsync(&_host[0], size(), &_upload);
+            _device_valid = true;
+        }
+        
+        if (access != READ) {
+            _device_valid = true;
+            _host_valid = false;
+        }
+        
+        return *_device;
+    }
+    
+    void Image::clear (uint8_t value) {
+        allocateDevice();
+        
+        _device->fill(value);
+        _device_valid = true;
+        _host_valid = false;
+    }
+    
+    bool Image::hostValid () const {
+        return _host_valid;
+    }
+    
+    bool Image::deviceValid () const {
+        return _device_valid;
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  Image.h
+//  OCLW
+//
+
+#ifndef OCLW_Image_h
+#define OCLW_Image_h
+
+#include "OpenCL.h"
+#include "MemoryBuffer.h"
+#include "Handle.h"
+#include <stdint.h>
+#include <vector>
+
+namespace oclw {
+    class Controller;
+    
+    /*! 2D array of pixels kept both in host memory and in a device MemoryBuffer
+     *  (not an OpenCL image object).
+     *
+     *  Image remembers which copy holds the latest contents and transfers data
+     *  only when the other copy is accessed. Accessors say what the caller is
+     *  going to do with the data:
+     *
+     *  - READ: data is only read, stale copy is brought up to date first.
+     *  - WRITE: all data the caller needs is going to be written, nothing is transferred.
+     *  - READ_WRITE: both, so the accessed copy is brought up to date.
+     *
+     *  Writing to one copy makes the other stale:
+     *
+     *  \code
+     *  oclw::Image maxima (controller, width, height);
+     *  maxima.clear();                                         // fill on device, no transfer
+     *  kernel->launch(range, *input, maxima.device(oclw::Image::READ_WRITE), width, height);
+     *  writePng(path, maxima.host(oclw::Image::READ), ...);    // one readback
+     *  \endcode
+     *
+     *  Pointer returned by host() and buffer returned by device() may only be used
+     *  until the next call of any Image method. Image must not be used by several
+     *  threads at once.
+     */
+    class Image {
+    public:
+        enum Access {
+            READ,
+            WRITE,
+            READ_WRITE
+        };
+    
+    private:
+        Controller& _controller;
+        size_t _width, _height, _pixel_size;
+        
+        std::vector<uint8_t> _host;
+        Handle<MemoryBuffer> _device;
+        
+        bool _host_valid;
+        bool _device_valid;
+        
+        /* Upload still reading host memory */
+        cl_event _upload;
+        
+        Image (const Image&);
+        Image& operator= (const Image&);
+        
+        /* Waits for upload, so host memory can be changed */
+        void waitForUpload ();
+        
+        void allocateDevice ();
+    
+    public:
+        /*! Creates image whose host copy is zeroed. Device memory is allocated on first use.
+         *
+         *  \param pixel_size Size of one pixel in bytes.
+         */
+        Image (Controller* controller, size_t width, size_t height, size_t pixel_size = 1);
+        
+        ~Image ();
+        
+        size_t width () const;
+        size_t height () const;
+        
+        /*! Returns size of image in bytes.
+         */
+        size_t size () const;
+        
+        /*! Returns host copy, downloading it first if device copy is newer and access
+         *  is READ or READ_WRITE. Unless access is READ, device copy becomes stale.
+         */
+        uint8_t* host (Access access = READ_WRITE);
+        
+        /*! Returns device copy, uploading it first if host copy is newer and access
+         *  is READ or READ_WRITE. Upload is only enqueued. Unless access is READ,
+         *  host copy becomes stale.
+         */
+        MemoryBuffer& device (Access access = READ_WRITE);
+        
+        /*! Sets every byte to value on the device. Host copy becomes stale.
+         */
+        void clear (uint8_t value = 0);
+        
+        /*! Returns true if host copy holds the latest contents.
+         */
+        bool hostValid () const;
+        
+        /*! Returns true if device copy holds the latest contents.
+         */
+        bool deviceValid () const;
+    };
+}
+
+#endif
@@ -6,21 +6,28 @@
 //
 
 #include <iostream>
+#include <string>
+
+#include <string.h>
+#include <stdlib.h>
 
 #include "Kernel.h"
 #include "Exception.h"
 #include "MemoryBuffer.h"
 #include "Controller.h"
+#include "Program.h"
+#include "Trace.h"
 
 namespace oclw {
 
     Kernel::NDRange::NDRange (unsigned int dims) {
         _dims = dims;
-        _sizes = new size_t[dims];
-    }
-    
-    Kernel::NDRange::~NDRange () {
-        delete[] _sizes;
+        _has_offset = false;
+        
+        for (int i = 0; i < 3; i++) {
+            _sizes[i] = 1;
+            _offsets[i] = 0;
+        }
     }
        
     Kernel::NDRange Kernel::NDRange::range1D (size_t x) {
@@ -44,15 +51,29 @@ namespace oclw {
         return range;
     }
     
+    Kernel::NDRange Kernel::NDRange::withOffset (size_t x, size_t y, size_t z) const {
+        NDRange range(*this);
+        range._offsets[0] = x;
+        range._offsets[1] = y;
+        range._offsets[2] = z;
+        range._has_offset = true;
+        return range;
+    }
+    
     unsigned int Kernel::NDRange::dims () const {
         return _dims;
     }
     
-    size_t* Kernel::NDRange::sizes () const {
+    const size_t* Kernel::NDRange::sizes () const {
         return _sizes;
     }
     
-    bool Kernel::NDRange::divisible (NDRange& range) const {
+    const size_t* Kernel::NDRange::offsets () const {
+        /* NULL keeps OpenCL 1.0 devices happy when offset is not used */
+        return _has_offset ? _offsets : NULL;
+    }
+    
+    bool Kernel::NDRange::divisible (const NDRange& range) const {
         if (range.dims() != dims())
             return false;
             
@@ -63,12 +84,19 @@ namespace oclw {
         return true;
     }
     
-    Kernel::Kernel (Controller& c, cl_kernel id) : _controller(c), _id(id) {
+    Kernel::Kernel (Controller& c, Program& p, cl_kernel id) : _controller(c), _program(p), _id(id) {
+        _controller._live_kernels++;
         
+        char name[256];
+        if (clGetKernelInfo(_id, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL) == CL_SUCCESS)
+            _name = name;
+        
+        queryArguments();
     }
     
     Kernel::~Kernel () {
         release();
+        _controller._live_kernels--;
     }
 
     void Kernel::release () {
@@ -76,45 +104,165 @@ namespace oclw {
             clReleaseKernel(_id);
     }
 
+    Kernel* Kernel::clone () {
+        if (_name.empty())
+            throw Exception("Could not read kernel name.");
+        
+        return _program.createKernel(_name.c_str());
+    }
+    
+    Program& Kernel::program () const {
+        return _program;
+    }
+    
+    size_t Kernel::workGroupSize () const {
+        size_t size;
+        
+        if (clGetKernelWorkGroupInfo(_id, _controller.device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size), &size, NULL) != CL_SUCCESS)
+            throw Exception("Could not read kernel work group size.");
+        
+        return size;
+    }
+    
+    size_t Kernel::preferredWorkGroupSizeMultiple () const {
+        size_t multiple = 1;
+        
+#ifdef CL_VERSION_1_1
+        if (clGetKernelWorkGroupInfo(_id, _controller.device(), CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                     sizeof(multiple), &multiple, NULL) != CL_SUCCESS)
+            multiple = 1;
+#endif
+        
+        return multiple;
+    }
+    
+    /* Returns size of OpenCL built-in scalar or vector type, 0 for other types.
+     */
+    static size_t typeSize (std::string name) {
+        static const char* names[] = { "char", "uchar", "short", "ushort", "int", "uint", "long", "ulong", "float", "double", "half" };
+        static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 2 };
+        
+        /* Vector types: int4, float16, ... (3 component vectors take space of 4) */
+        size_t digits = name.find_first_of("0123456789");
+        size_t components = 1;
+        
+        if (digits != std::string::npos) {
+            components = atoi(name.c_str() + digits);
+            components = components == 3 ? 4 : components;
+            name = name.substr(0, digits);
+        }
+        
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+            if (name == names[i])
+                return sizes[i] * components;
+        
+        return 0;
+    }
+    
+    void Kernel::queryArguments () {
+        cl_uint count;
+        
+        if (clGetKernelInfo(_id, CL_KERNEL_NUM_ARGS, sizeof(count), &count, NULL) != CL_SUCCESS)
+            throw Exception("Could not read number of kernel arguments.");
+        
+        _arguments.resize(count);
+        
+#ifdef CL_VERSION_1_2
+        /* Only available if program was built with -cl-kernel-arg-info */
+        for (cl_uint i = 0; i < count; i++) {
+            cl_kernel_arg_address_qualifier address;
+            char type_name[128];
+            
+            if (clGetKernelArgInfo(_id, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(address), &address, NULL) != CL_SUCCESS)
+                break;
+            
+            _arguments[i].address = address;
+            
+            if (address == CL_KERNEL_ARG_ADDRESS_PRIVATE &&
+                clGetKernelArgInfo(_id, i, CL_KERNEL_ARG_TYPE_NAME, sizeof(type_name), type_name, NULL) == CL_SUCCESS)
+                _arguments[i].type_size = typeSize(type_name);
+        }
+#endif
+    }
+    
+    void Kernel::checkArgument (uint32_t index, cl_uint address, size_t size) const {
+        const Argument& argument = _arguments[index];
+        
+        if (argument.address == 0)
+            return;
+        
+        /* Buffers can be passed to both __global and __constant arguments */
+        if (address == CL_KERNEL_ARG_ADDRESS_GLOBAL && argument.address == CL_KERNEL_ARG_ADDRESS_CONSTANT)
+            return;
+        
+        if (argument.address != address)
+            throw Exception("Kernel argument address space does not match kernel definition.");
+        
+        if (address == CL_KERNEL_ARG_ADDRESS_PRIVATE && argument.type_size != 0 && argument.type_size != size)
+            throw Exception("Kernel argument size does not match kernel definition.");
+    }
+    
+    void Kernel::bindArgument (uint32_t index, const MemoryBuffer& memoryBuffer) {
+        checkArgument(index, CL_KERNEL_ARG_ADDRESS_GLOBAL, sizeof(cl_mem));
+        
+        setMemoryArgument(index, memoryBuffer.id());
+    }
+    
+    void Kernel::bindArgument (uint32_t index, MemoryBuffer* memoryBuffer) {
+        bindArgument(index, *memoryBuffer);
+    }
+    
+    void Kernel::bindArgument (uint32_t index, const Local& local) {
+        checkArgument(index, CL_KERNEL_ARG_ADDRESS_LOCAL, local.size);
+        setArgument(index, local.size, NULL);
+    }
+    
     void Kernel::setArgument(uint32_t index, size_t size, const void* value) {
+        /* Skip arguments that already have this value */
+        if (index < _arguments.size()) {
+            const Argument& argument = _arguments[index];
+            
+            if (argument.bound && argument.local == (value == NULL) && argument.value.size() == size &&
+                (value == NULL || memcmp(&argument.value[0], value, size) == 0))
+                return;
+        }
+        
+        TraceSpan span ("setArgument");
         cl_int err = clSetKernelArg(_id, index, size, value);
         
         if (err != CL_SUCCESS)
             throw Exception("Could not set kernel argument.");
+        
+        if (index < _arguments.size()) {
+            Argument& argument = _arguments[index];
+            argument.bound = true;
+            argument.local = value == NULL;
+            
+            /* For local arguments only size is remembered */
+            argument.value.resize(size);
+            if (value != NULL)
+                memcpy(&argument.value[0], value, size);
+        }
     }
     
     void Kernel::setArgument(uint32_t index, MemoryBuffer& memoryBuffer) {
-        cl_mem id = memoryBuffer.id();
-        setArgument(index, sizeof(cl_mem), &id);
+        setMemoryArgument(index, memoryBuffer.id());
     }
     
-    void Kernel::execute (NDRange global_work_size) {
-        cl_int err = clEnqueueNDRangeKernel(_controller.cmdQueue(), _id,
-                        global_work_size.dims(), NULL, global_work_size.sizes(),
-                        NULL, 0, NULL, NULL);
-        
-        clFinish(_controller.cmdQueue());
+    void Kernel::setMemoryArgument (uint32_t index, cl_mem id) {
+        TraceSpan span ("setArgument");
+        cl_int err = clSetKernelArg(_id, index, sizeof(cl_mem), &id);
         
         if (err != CL_SUCCESS)
-            throw Exception("Could not execute kernel.");
+            throw Exception("Could not set kernel argument.");
+        
+        if (index < _arguments.size())
+            _arguments[index].bound = false;
     }
     
-    void Kernel::execute (NDRange global_work_size, NDRange local_work_size) {
-        if (global_work_size.dims() != local_work_size.dims())
-            throw Exception("Number of specified dimensions of global and local work range is not equal!");   
-            
-        if (!global_work_size.divisible(local_work_size))
-            throw Exception("Global group size not divisible with local group size.");
-    
-        cl_int err = clEnqueueNDRangeKernel(_controller.cmdQueue(), _id,
-                        global_work_size.dims(),    // working dimensions
-                        NULL,                       // offset
-                        global_work_size.sizes(),   // global work size
-                        local_work_size.sizes(),    // local work size
-                        0, NULL, NULL);
-        
-        clFinish(_controller.cmdQueue());
-        
+    /* Translates clEnqueueNDRangeKernel error code to an exception.
+     */
+    static void checkExecuteError (cl_int err) {
         switch (err) {
             case CL_SUCCESS:
                 return;
@@ -132,4 +280,60 @@ namespace oclw {
                 throw Exception("Could not execute kernel.");
         }
     }
+    
+    void Kernel::execute (NDRange global_work_size) {
+        executeAsync(global_work_size);
+        
+        TraceSpan span ("wait for kernel");
+        clFinish(_controller.cmdQueue());
+    }
+    
+    void Kernel::execute (NDRange global_work_size, NDRange local_work_size) {
+        executeAsync(global_work_size, local_work_size);
+        
+        TraceSpan span ("wait for kernel");
+        clFinish(_controller.cmdQueue());
+    }
+    
+    void Kernel::executeAsync (const NDRange& global_work_size, cl_event* event) {
+        TraceSpan span ("enqueue kernel");
+        
+        /* Traced commands always need an event to read timestamps from */
+        cl_event traced;
+        cl_event* target = event == NULL && Trace::enabled() ? &traced : event;
+        
+        cl_int err = clEnqueueNDRangeKernel(_controller.cmdQueue(), _id,
+                        global_work_size.dims(), global_work_size.offsets(), global_work_size.sizes(),
+                        NULL, 0, NULL, target);
+        
+        checkExecuteError(err);
+        
+        if (Trace::enabled())
+            Trace::device(*target, _name.c_str(), _controller.cmdQueue(), event == NULL);
+    }
+    
+    void Kernel::executeAsync (const NDRange& global_work_size, const NDRange& local_work_size, cl_event* event) {
+        if (global_work_size.dims() != local_work_size.dims())
+            throw Exception("Number of specified dimensions of global and local work range is not equal!");   
+            
+        if (!global_work_size.divisible(local_work_size))
+            throw Exception("Global group size not divisible with local group size.");
+    
+        TraceSpan span ("enqueue kernel");
+        
+        cl_event traced;
+        cl_event* target = event == NULL && Trace::enabled() ? &traced : event;
+        
+        cl_int err = clEnqueueNDRangeKernel(_controller.cmdQueue(), _id,
+                        global_work_size.dims(),    // working dimensions
+                        global_work_size.offsets(), // offset
+                        global_work_size.sizes(),   // global work size
+                        local_work_size.sizes(),    // local work size
+                        0, NULL, target);
+        
+        checkExecuteError(err);
+        
+        if (Trace::enabled())
+            Trace::device(*target, _name.c_str(), _controller.cmdQueue(), event == NULL);
+    }
 }
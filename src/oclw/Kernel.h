@@ -9,19 +9,53 @@
 #define OCLW_Kernel_h
 
 #include "OpenCL.h"
+#include "Exception.h"
+#include <vector>
+#include <string>
+#include <type_traits>
 
 namespace oclw {
     class Controller;
     class MemoryBuffer;
+    class Program;
+    
+    /*! Size of a __local kernel argument. OpenCL allocates that much local
+     *  memory for each work group.
+     *  
+     *  \code
+     *  kernel->launch(range, *buffer, oclw::Local(256 * sizeof(float)));
+     *  \endcode
+     */
+    struct Local {
+        size_t size;
+        
+        explicit Local (size_t s) : size (s) {}
+    };
     
     /*! Encapsulates OpenCL kernel object.
      *  
      *  Kernel object can only be created by Program object of
      *  which kernel is a part.
+     *  
+     *  Arguments are part of the kernel object, so one Kernel must not be
+     *  used by several threads at once. Each thread should use its own
+     *  instance, obtained with clone().
+     *  
+     *  Arguments can be set one by one with setArgument(), or all at once with
+     *  bind() / launch(), which check them against kernel definition:
+     *  
+     *  \code
+     *  kernel->launch(oclw::Kernel::NDRange::range2D(w, h), *input, *output, w, h);
+     *  \endcode
+     *  
+     *  Last value of each argument is remembered and setting the same value
+     *  again does not call OpenCL. Buffers are always set, since a released
+     *  buffer's handle may be reused by a new one.
      */
     class Kernel {
         friend class Controller;
         friend class Program;
+        friend class CommandList;
         
     public:
         /*! Use this class when there is a need to define size of 1,
@@ -30,19 +64,26 @@ namespace oclw {
          *  \code
          *  oclw::Kernel::NDRange size = oclw::Kernel::NDRange::range2D(32, 16);
          *  \endcode
+         *  
+         *  Objects are small and can be freely copied.
          */
         class NDRange {
             unsigned int _dims;
-            size_t* _sizes;
+            size_t _sizes[3];
+            size_t _offsets[3];
+            bool _has_offset;
             
             NDRange (unsigned int dims);
         public:
-            ~NDRange ();
-            
             static NDRange range1D (size_t x);
             static NDRange range2D (size_t x, size_t y);
             static NDRange range3D (size_t x, size_t y, size_t z);
             
+            /*! Returns a copy of this range whose work-item IDs start at given offset
+             *  instead of 0. Only meaningful for global work size.
+             */
+            NDRange withOffset (size_t x, size_t y = 0, size_t z = 0) const;
+            
             /*! Returns a number of dimensions.
              */
             unsigned int dims () const;
@@ -50,39 +91,116 @@ namespace oclw {
             /*! Returns a pointer to an array of dims() elements.
              *  Each element contains size of one dimension.
              */
-            size_t* sizes () const;
+            const size_t* sizes () const;
+            
+            /*! Returns a pointer to an array of dims() offsets, or NULL if
+             *  offset was not set.
+             */
+            const size_t* offsets () const;
             
             /*! For each dimension size checks if its divisible
              *  by coresponding dimension size of passed NDRange object.
              *  
              *  \return true if divisible, false otherwise.
              */
-            bool divisible (NDRange& range) const;
+            bool divisible (const NDRange& range) const;
         };
         
     private:
+        /* What is known about an argument from kernel definition and
+         * what was last set to it.
+         */
+        struct Argument {
+            cl_uint address;                    /* CL_KERNEL_ARG_ADDRESS_*, 0 if unknown */
+            size_t type_size;                   /* Size of private argument, 0 if unknown */
+            bool bound;                         /* Value below was set; never for memory objects */
+            bool local;
+            std::vector<unsigned char> value;
+            
+            Argument () : address (0), type_size (0), bound (false), local (false) {}
+        };
+        
         cl_kernel _id;
+        std::string _name;
         
         Controller& _controller;
+        Program& _program;
+        
+        std::vector<Argument> _arguments;
         
     private:
         /* Private constructor enforces integrity stability.
          * Can only be instantiated from Controller (friend).
          */
-        Kernel (Controller& c, cl_kernel id);
+        Kernel (Controller& c, Program& p, cl_kernel id);
         ~Kernel ();
         
         /* Clears Kernel from memory.
          */
         void release ();
         
+        /* Reads number of arguments and, if program was built with argument
+         * info, their address spaces and types.
+         */
+        void queryArguments ();
+        
+        /* Throws if argument definition is known and does not match.
+         */
+        void checkArgument (uint32_t index, cl_uint address, size_t size) const;
+        
+        /* Sets buffer argument. Always passed to OpenCL: a buffer reallocated in place
+         * (MemoryBuffer::allocate) may get the handle value of the released one.
+         */
+        void setMemoryArgument (uint32_t index, cl_mem id);
+        
+        void bindArgument (uint32_t index, const MemoryBuffer& memoryBuffer);
+        void bindArgument (uint32_t index, MemoryBuffer* memoryBuffer);
+        void bindArgument (uint32_t index, const Local& local);
+        
+        template <typename T>
+        void bindArgument (uint32_t index, const T& value) {
+            static_assert(std::is_pod<T>::value && !std::is_pointer<T>::value,
+                          "Kernel argument must be a MemoryBuffer, Local or a plain value.");
+            checkArgument(index, CL_KERNEL_ARG_ADDRESS_PRIVATE, sizeof(T));
+            setArgument(index, sizeof(T), &value);
+        }
+        
+        void bindArguments (uint32_t) {}
+        
+        template <typename T, typename... Rest>
+        void bindArguments (uint32_t index, const T& value, const Rest&... rest) {
+            bindArgument(index, value);
+            bindArguments(index + 1, rest...);
+        }
+        
     public:
+        /*! Creates new instance of the same kernel, owned by the same Program.
+         *  Arguments are not copied, they have to be set on the new instance.
+         */
+        Kernel* clone ();
+        
+        /*! Returns program this kernel is part of.
+         */
+        Program& program () const;
+        
+        /*! Returns largest work group size this kernel can be launched with,
+         *  which may be smaller than device maximum (register or local memory use).
+         */
+        size_t workGroupSize () const;
+        
+        /*! Returns multiple of work group size that device executes most
+         *  efficiently (warp or wavefront size). Returns 1 if unknown.
+         */
+        size_t preferredWorkGroupSizeMultiple () const;
+        
         /*! Sets Kernel argument.
          *  
          *  \param index Index of argument as defined in kernel's source.
          *  \param size Size of argument in bytes. For example: if argument
          *  is of type int, pass sizeof(int).
          *  \param value Pointer to actual value. Will be copied at call.
+         *  Value equal to the one set last time is not passed to OpenCL again,
+         *  so buffers should be set as MemoryBuffer.
          */
         void setArgument(uint32_t index, size_t size, const void* value);
         
@@ -93,6 +211,52 @@ namespace oclw {
          */
         void setArgument(uint32_t index, MemoryBuffer& memoryBuffer);
         
+        /*! Sets all arguments at once, in order of kernel definition.
+         *  
+         *  Arguments can be MemoryBuffer objects (or pointers to them), Local sizes
+         *  and plain values such as int or float. Number of arguments is always
+         *  checked. If program was built with argument info (OpenCL 1.2 devices),
+         *  address space and size of each argument are checked too.
+         *  Unchanged arguments other than buffers are not set again.
+         */
+        template <typename... Args>
+        void bind (const Args&... args) {
+            if (sizeof...(Args) != _arguments.size())
+                throw Exception("Number of kernel arguments does not match kernel definition.");
+            
+            bindArguments(0, args...);
+        }
+        
+        /*! Same as bind(), returns kernel so execution can follow:
+         *  
+         *  \code
+         *  (*kernel)(*input, *output, width).execute(range);
+         *  \endcode
+         */
+        template <typename... Args>
+        Kernel& operator() (const Args&... args) {
+            bind(args...);
+            return *this;
+        }
+        
+        /*! Sets all arguments (see bind()) and enqueues Kernel for execution
+         *  without waiting for it to finish.
+         */
+        template <typename... Args>
+        void launch (const NDRange& global_work_size, const Args&... args) {
+            bind(args...);
+            executeAsync(global_work_size);
+        }
+        
+        /*! Sets all arguments (see bind()) and enqueues Kernel for execution with
+         *  specified local work group size without waiting for it to finish.
+         */
+        template <typename... Args>
+        void launch (const NDRange& global_work_size, const NDRange& local_work_size, const Args&... args) {
+            bind(args...);
+            executeAsync(global_work_size, local_work_size);
+        }
+        
         /*! Executes Kernel. OpenCL will automatically calculate local work group size.
          *  
          *  \param global_work_size Global work size.
@@ -106,6 +270,26 @@ namespace oclw {
          *  items per dimension in a work group).
          */
         void execute (NDRange global_work_size, NDRange local_work_size);
+        
+        /*! Enqueues Kernel for execution and returns without waiting for it to finish.
+         *  OpenCL will automatically calculate local work group size.
+         *  
+         *  \param global_work_size Global work size.
+         *  \param event If not NULL, receives an event that completes with the execution.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void executeAsync (const NDRange& global_work_size, cl_event* event = NULL);
+        
+        /*! Enqueues Kernel for execution with specified local work group size
+         *  and returns without waiting for it to finish.
+         *  
+         *  \param global_work_size Global work size.
+         *  \param local_work_size Local work size (number of work
+         *  items per dimension in a work group).
+         *  \param event If not NULL, receives an event that completes with the execution.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void executeAsync (const NDRange& global_work_size, const NDRange& local_work_size, cl_event* event = NULL);
     };
 }
 
@@ -6,27 +6,42 @@
 //
 
 #include <iostream>
+#include <vector>
 
 #include "OpenCL.h"
 #include "Exception.h"
 #include "MemoryBuffer.h"
 #include "Controller.h"
+#include "Trace.h"
 
 namespace oclw {
-    MemoryBuffer::MemoryBuffer (Controller& c) : _controller(c), _id(0) {
+    MemoryBuffer::MemoryBuffer (Controller& c) : _controller(c), _id(0), _size(0) {
+        _controller._live_memory_buffers++;
     }
     
-    MemoryBuffer::MemoryBuffer (Controller& c, AccessMode mode, size_t size, void* data) : _controller(c), _id(0) {
-        allocate(mode, size, data);
+    MemoryBuffer::MemoryBuffer (Controller& c, AccessMode mode, size_t size, void* data) : _controller(c), _id(0), _size(0) {
+        _controller._live_memory_buffers++;
+        
+        try {
+            allocate(mode, size, data);
+        } catch (...) {
+            _controller._live_memory_buffers--;
+            throw;
+        }
     }
     
     MemoryBuffer::~MemoryBuffer () {
         release();
+        _controller._live_memory_buffers--;
     }
 
     void MemoryBuffer::release () {
-        if (_id != 0)
+        if (_id != 0) {
             clReleaseMemObject(_id);
+            _controller.trackRelease(_size);
+            _id = 0;
+            _size = 0;
+        }
     }
         
     void MemoryBuffer::allocate (AccessMode mode, size_t size, void* data) {
@@ -38,22 +53,133 @@ namespace oclw {
         
         if (err != CL_SUCCESS)
             throw Exception("Could not allocate memory buffer.");
+        
+        _mode = mode;
+        _size = size;
+        _controller.trackAllocation(size);
+    }
+    
+    void MemoryBuffer::reserve (AccessMode mode, size_t size) {
+        if (_size < size)
+            allocate(mode, size);
     }
 
     void MemoryBuffer::writeData (void* data, size_t size) {
-        cl_int err = clEnqueueWriteBuffer(_controller.cmdQueue(), _id, CL_TRUE, 0, size, data, 0, NULL, NULL);
+        TraceSpan span ("writeData");
+        
+        cl_event traced;
+        cl_event* target = Trace::enabled() ? &traced : NULL;
+        cl_int err = clEnqueueWriteBuffer(_controller.cmdQueue(), _id, CL_TRUE, 0, size, data, 0, NULL, target);
+        
+        if (Trace::enabled() && err == CL_SUCCESS)
+            Trace::device(*target, "write", _controller.cmdQueue(), true);
         
         if (err != CL_SUCCESS)
             throw Exception("Could not write data to memory buffer. Not allocated?");
     }
 
     void MemoryBuffer::readData (void* data, size_t size) {
-        cl_int err = clEnqueueReadBuffer(_controller.cmdQueue(), _id, CL_TRUE, 0, size, data, 0, NULL, NULL);
+        TraceSpan span ("readData");
+        
+        cl_event traced;
+        cl_event* target = Trace::enabled() ? &traced : NULL;
+        cl_int err = clEnqueueReadBuffer(_controller.cmdQueue(), _id, CL_TRUE, 0, size, data, 0, NULL, target);
+        
+        if (Trace::enabled() && err == CL_SUCCESS)
+            Trace::device(*target, "read", _controller.cmdQueue(), true);
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not read data from memory buffer. Not allocated?");
+    }
+    
+    void MemoryBuffer::writeDataAsync (const void* data, size_t size, cl_event* event) {
+        TraceSpan span ("writeDataAsync");
+        
+        cl_event traced;
+        cl_event* target = event == NULL && Trace::enabled() ? &traced : event;
+        cl_int err = clEnqueueWriteBuffer(_controller.cmdQueue(), _id, CL_FALSE, 0, size, data, 0, NULL, target);
+        
+        if (Trace::enabled() && err == CL_SUCCESS)
+            Trace::device(*target, "write", _controller.cmdQueue(), event == NULL);
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not write data to memory buffer. Not allocated?");
+    }
+    
+    void MemoryBuffer::readDataAsync (void* data, size_t size, cl_event* event) {
+        TraceSpan span ("readDataAsync");
+        
+        cl_event traced;
+        cl_event* target = event == NULL && Trace::enabled() ? &traced : event;
+        cl_int err = clEnqueueReadBuffer(_controller.cmdQueue(), _id, CL_FALSE, 0, size, data, 0, NULL, target);
+        
+        if (Trace::enabled() && err == CL_SUCCESS)
+            Trace::device(*target, "read", _controller.cmdQueue(), event == NULL);
         
         if (err != CL_SUCCESS)
             throw Exception("Could not read data from memory buffer. Not allocated?");
     }
     
+    void MemoryBuffer::fill (uint8_t value) {
+        fill(value, 0, _size);
+    }
+    
+    void MemoryBuffer::fill (uint8_t value, size_t offset, size_t size, cl_event* event) {
+        TraceSpan span ("fill");
+        
+        if (offset + size > _size)
+            throw Exception("Fill range exceeds memory buffer.");
+        
+        cl_int err;
+        
+#ifdef CL_VERSION_1_2
+        if (_controller.supportsOpenCL12()) {
+            cl_event traced;
+            cl_event* target = event == NULL && Trace::enabled() ? &traced : event;
+            err = clEnqueueFillBuffer(_controller.cmdQueue(), _id, &value, sizeof(value), offset, size, 0, NULL, target);
+            
+            if (Trace::enabled() && err == CL_SUCCESS)
+                Trace::device(*target, "fill", _controller.cmdQueue(), event == NULL);
+            
+            if (err != CL_SUCCESS)
+                throw Exception("Could not fill memory buffer. Not allocated?");
+            
+            return;
+        }
+#endif
+        
+        /* Pattern has to come from host, blocking so it can be freed */
+        std::vector<uint8_t> pattern (size, value);
+        err = clEnqueueWriteBuffer(_controller.cmdQueue(), _id, CL_TRUE, offset, size, pattern.data(), 0, NULL, event);
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not fill memory buffer. Not allocated?");
+    }
+    
+    void* MemoryBuffer::map (MapMode mode) {
+        TraceSpan span ("map");
+        cl_int err;
+        void* ptr = clEnqueueMapBuffer(_controller.cmdQueue(), _id, CL_TRUE, mode, 0, _size, 0, NULL, NULL, &err);
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not map memory buffer. Not allocated?");
+        
+        return ptr;
+    }
+    
+    void MemoryBuffer::unmap (void* ptr) {
+        TraceSpan span ("unmap");
+        cl_int err = clEnqueueUnmapMemObject(_controller.cmdQueue(), _id, ptr, 0, NULL, NULL);
+        clFinish(_controller.cmdQueue());
+        
+        if (err != CL_SUCCESS)
+            throw Exception("Could not unmap memory buffer.");
+    }
+    
+    size_t MemoryBuffer::size () const {
+        return _size;
+    }
+    
     cl_mem MemoryBuffer::id() const {
         return _id;
     }
@@ -9,6 +9,7 @@
 #define OCLW_MemoryBuffer_h
 
 #include "OpenCL.h"
+#include <stdint.h>
 
 namespace oclw {
     class Controller;
@@ -29,10 +30,21 @@ namespace oclw {
             READ_WRITE = CL_MEM_READ_WRITE, /*!< If OpenCL program will write to and read from the buffer. */
             READ = CL_MEM_READ_ONLY,        /*!< If OpenCL program will only read from the buffer. */
             WRITE = CL_MEM_WRITE_ONLY,      /*!< If OpenCL program will only write to the buffer. */
-            HOST = CL_MEM_USE_HOST_PTR      /*!< Use this to map host (system) memory to the OpenCL device.
+            HOST = CL_MEM_USE_HOST_PTR,     /*!< Use this to map host (system) memory to the OpenCL device.
                                                 Memory will be shared between host and OpenCL device. Note: access to
                                                 this type of memory buffer from OpenCL device is very slow unless device anyways
                                                 uses host memory as its global memory (such as integrated GPUs) */
+            PINNED = CL_MEM_ALLOC_HOST_PTR  /*!< Allocates memory buffer in host accessible (page-locked) memory. Use map()
+                                                to get its host pointer. Transfers from/to that pointer are the fastest
+                                                transfers available on discrete GPUs. */
+        };
+        
+        /*! Specifies what host will do with mapped memory.
+         */
+        enum MapMode {
+            MAP_READ = CL_MAP_READ,                         /*!< Host will only read mapped memory. */
+            MAP_WRITE = CL_MAP_WRITE,                       /*!< Host will only write to mapped memory. */
+            MAP_READ_WRITE = CL_MAP_READ | CL_MAP_WRITE     /*!< Host will read and write mapped memory. */
         };
         
     private:
@@ -63,6 +75,12 @@ namespace oclw {
          */
         void allocate (AccessMode mode, size_t size, void* data = NULL);
         
+        /*! Allocates memory unless at least size bytes are already allocated, so that
+         *  buffers reused for inputs of changing size only grow. Contents are lost
+         *  when buffer grows.
+         */
+        void reserve (AccessMode mode, size_t size);
+        
         /*! Copies data from host to OpenCL device.
          *  
          *  \param data Pointer to the data that needs to be copied.
@@ -77,6 +95,56 @@ namespace oclw {
          */
         void readData (void* data, size_t size);
         
+        /*! Starts copying data from host to OpenCL device and returns immediately.
+         *  
+         *  \param data Pointer to the data that needs to be copied. Must stay valid
+         *  until the transfer completes.
+         *  \param size Size of the data to copy in bytes.
+         *  \param event If not NULL, receives an event that completes with the transfer.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void writeDataAsync (const void* data, size_t size, cl_event* event = NULL);
+        
+        /*! Starts copying data from OpenCL device back to host and returns immediately.
+         *  
+         *  \param data Pointer to the memory block where data will be copied. Must not
+         *  be accessed until the transfer completes.
+         *  \param size Size of the data to copy in bytes.
+         *  \param event If not NULL, receives an event that completes with the transfer.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void readDataAsync (void* data, size_t size, cl_event* event = NULL);
+        
+        /*! Sets every byte of the buffer to value on the device, without transferring
+         *  anything from host. Returns immediately.
+         */
+        void fill (uint8_t value);
+        
+        /*! Sets size bytes starting at offset to value on the device and returns
+         *  immediately. On OpenCL 1.0/1.1 devices, falls back to a (blocking) write.
+         *  
+         *  \param event If not NULL, receives an event that completes with the fill.
+         *  Caller is responsible for releasing it (clReleaseEvent).
+         */
+        void fill (uint8_t value, size_t offset, size_t size, cl_event* event = NULL);
+        
+        /*! Maps memory buffer into host address space. Blocks until mapping is done.
+         *  
+         *  \param mode What host will do with mapped memory.
+         *  \return Pointer to the mapped memory. Must be released with unmap().
+         */
+        void* map (MapMode mode = MAP_READ_WRITE);
+        
+        /*! Releases mapping returned by map().
+         *  
+         *  \param ptr Pointer returned by map().
+         */
+        void unmap (void* ptr);
+        
+        /*! Returns size of allocated memory in bytes.
+         */
+        size_t size () const;
+        
         /*! Returns unique ID of MemoryBuffer object.
          */
         cl_mem id () const;
@@ -13,4 +13,14 @@
 #include <OpenCL/cl.h>
 #else
 #include <CL/cl.h>
-#endif
\ No newline at end of file
+#endif
+
+/** Kernel argument address spaces are used by Kernel even
+    when built against OpenCL 1.1 headers.
+ */
+#ifndef CL_KERNEL_ARG_ADDRESS_GLOBAL
+#define CL_KERNEL_ARG_ADDRESS_GLOBAL    0x119B
+#define CL_KERNEL_ARG_ADDRESS_LOCAL     0x119C
+#define CL_KERNEL_ARG_ADDRESS_CONSTANT  0x119D
+#define CL_KERNEL_ARG_ADDRESS_PRIVATE   0x119E
+#endif
@@ -0,0 +1,35 @@
+//
+//  PingPong.cpp
+//  OCLW
+//
+
+#include "PingPong.h"
+#include "Controller.h"
+
+namespace oclw {
+
+    PingPong::PingPong (Controller* controller, size_t size) : _current (0) {
+        for (int i = 0; i < 2; i++)
+            _buffers[i].reset(controller->createMemoryBuffer(MemoryBuffer::READ_WRITE, size));
+    }
+    
+    MemoryBuffer& PingPong::source () {
+        return *_buffers[_current];
+    }
+    
+    MemoryBuffer& PingPong::target () {
+        return *_buffers[1 - _current];
+    }
+    
+    void PingPong::swap () {
+        _current = 1 - _current;
+    }
+    
+    void PingPong::write (const void* data, size_t size) {
+        source().writeDataAsync(data, size);
+    }
+    
+    void PingPong::read (void* data, size_t size) {
+        source().readData(data, size);
+    }
+}
@@ -0,0 +1,113 @@
+//
+//  PingPong.h
+//  OCLW
+//
+
+#ifndef OCLW_PingPong_h
+#define OCLW_PingPong_h
+
+#include "OpenCL.h"
+#include "Kernel.h"
+#include "MemoryBuffer.h"
+#include "Handle.h"
+
+namespace oclw {
+    class Controller;
+    
+    /*! Pair of device buffers that take turns as input and output of passes
+     *  of an iterative filter.
+     *
+     *  Each pass reads the result of the previous one (Source) and writes a new
+     *  one (Target), then the buffers swap roles. Passes are only enqueued: the
+     *  command queue keeps them in order, so there are no host round trips or
+     *  waits between them. Only the final result is read back:
+     *
+     *  \code
+     *  oclw::PingPong chain (controller, width * height);
+     *  chain.write(image, width * height);
+     *  chain.iterate(smooth, 10, oclw::Kernel::NDRange::range2D(width, height),
+     *                oclw::PingPong::Source(), oclw::PingPong::Target(), width, height);
+     *  chain.read(result, width * height);
+     *  \endcode
+     *
+     *  Different kernels can be chained with pass(). Kernels must produce the
+     *  whole Target, since it still holds the result of the pass before last.
+     */
+    class PingPong {
+    public:
+        /*! Kernel argument standing for the buffer with result of the previous pass.
+         */
+        struct Source {};
+        
+        /*! Kernel argument standing for the buffer the pass writes to.
+         */
+        struct Target {};
+    
+    private:
+        Handle<MemoryBuffer> _buffers[2];
+        unsigned int _current;
+        
+        PingPong (const PingPong&);
+        PingPong& operator= (const PingPong&);
+        
+        MemoryBuffer& resolve (const Source&) { return source(); }
+        MemoryBuffer& resolve (const Target&) { return target(); }
+        
+        template <typename T>
+        const T& resolve (const T& value) { return value; }
+    
+    public:
+        /*! Allocates two device buffers of given size.
+         */
+        PingPong (Controller* controller, size_t size);
+        
+        /*! Buffer holding the result of the last pass (or the initial data).
+         */
+        MemoryBuffer& source ();
+        
+        /*! Buffer next pass writes to.
+         */
+        MemoryBuffer& target ();
+        
+        /*! Exchanges roles of the buffers. Called by pass() after each kernel.
+         */
+        void swap ();
+        
+        /*! Starts copying initial data to the source buffer and returns immediately.
+         *  Data must stay valid until read() returns.
+         */
+        void write (const void* data, size_t size);
+        
+        /*! Enqueues one pass: sets arguments (see Kernel::bind()), with Source and
+         *  Target replaced by the current buffers, and swaps the buffers.
+         */
+        template <typename... Args>
+        void pass (Kernel* kernel, const Kernel::NDRange& global_work_size, const Args&... args) {
+            kernel->launch(global_work_size, resolve(args)...);
+            swap();
+        }
+        
+        /*! Same as above, with specified local work group size.
+         */
+        template <typename... Args>
+        void pass (Kernel* kernel, const Kernel::NDRange& global_work_size, const Kernel::NDRange& local_work_size,
+                   const Args&... args) {
+            kernel->launch(global_work_size, local_work_size, resolve(args)...);
+            swap();
+        }
+        
+        /*! Enqueues passes of the same kernel.
+         */
+        template <typename... Args>
+        void iterate (Kernel* kernel, unsigned int passes, const Args&... args) {
+            for (unsigned int i = 0; i < passes; i++)
+                pass(kernel, args...);
+        }
+        
+        /*! Reads the final result. Blocks until all passes and the transfer are done.
+         */
+        void read (void* data, size_t size);
+    };
+}
+
+#endif
@@ -7,8 +7,12 @@
 
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <atomic>
 
 #include <string.h>
+#include <stdio.h>
 
 #include "Program.h"
 #include "Controller.h"
@@ -16,74 +20,194 @@
 #include "Kernel.h"
 
 namespace oclw {
-    Program::Program (Controller& c) : _controller (c) {
+    
+    /* Result of a build, shared with the callback OpenCL calls when build is done */
+    struct Program::Build {
+        std::promise<void> promise;
+        std::atomic_flag done;
+        cl_device_id device;
+        
+        Build () {
+            done.clear();
+        }
+    };
+    
+    Program::Program (Controller& c) : _controller (c), _build_state (NULL) {
         _id = 0;
+        _controller._live_programs++;
     }
     
     Program::~Program () {
         release();
+        _controller._live_programs--;
     }
 
     void Program::release () {
+        /* Build callback must not outlive its state */
+        if (_build.valid())
+            _build.wait();
+        
+        delete _build_state;
+        _build_state = NULL;
+        _build = std::shared_future<void>();
+        
         if (_id != 0) {            
             /* Delete allocated memory buffer objects
              */
             for (int i = 0; i < _kernels.size(); i++)
                 delete _kernels[i];
+            _kernels.clear();
+            _named_kernels.clear();
             
             /* Delete program
              */
             clReleaseProgram(_id);
+            _id = 0;
+        }
+    }
+    
+    void CL_CALLBACK Program::buildFinished (cl_program program, void* user_data) {
+        Build* build = (Build*)user_data;
+        
+        /* Failed builds may be reported both by callback and by clBuildProgram */
+        if (build->done.test_and_set())
+            return;
+        
+        cl_build_status status = CL_BUILD_ERROR;
+        clGetProgramBuildInfo(program, build->device, CL_PROGRAM_BUILD_STATUS, sizeof(status), &status, NULL);
+        
+        if (status == CL_BUILD_SUCCESS) {
+            build->promise.set_value();
+            return;
         }
+        
+        size_t size = 0;
+        clGetProgramBuildInfo(program, build->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+        
+        std::vector<char> log (size + 1, '\0');
+        clGetProgramBuildInfo(program, build->device, CL_PROGRAM_BUILD_LOG, size, &log[0], NULL);
+        
+        build->promise.set_exception(std::make_exception_ptr(Exception(std::string("Error while compiling program:\n") + &log[0])));
     }
     
     void Program::compileFromSourceString (const char* source) {
+        compileFromSourceStringAsync(source).get();
+    }
+
+    void Program::compileFromSourceFile (const char* file_path) {
+        compileFromSourceFileAsync(file_path).get();
+    }
+    
+    std::shared_future<void> Program::compileFromSourceStringAsync (const char* source) {
         /* If already allocated, deallocate */
         release();
         
+        /* Argument info lets Kernel check arguments passed to bind() */
+        const char* options = _controller.supportsOpenCL12() ? "-cl-kernel-arg-info" : NULL;
+        
         cl_int err;
         _id = clCreateProgramWithSource(_controller.context(), 1, &source, NULL, &err);
         
-        err |= clBuildProgram(_id, 0, NULL, NULL, NULL, NULL);
-        
         if (err != CL_SUCCESS) {
-            char msg[2048];
-            char err_msg[] = "Error while compiling program:\n";
-            
-            strcpy (msg, err_msg);
-            clGetProgramBuildInfo(_id, _controller.device(), CL_PROGRAM_BUILD_LOG, sizeof(msg), msg + sizeof(err_msg) - 1, NULL);
-            throw Exception(msg);
+            _id = 0;
+            throw Exception("Could not create program.");
         }
-    }
-
-    void Program::compileFromSourceFile (const char* file_path) {
-        char* source;
         
-        std::ifstream file (file_path, std::ios::in | std::ios::binary | std::ios::ate);
+        _build_state = new Build;
+        _build_state->device = _controller.device();
+        _build = _build_state->promise.get_future().share();
+        
+        /* Returns as soon as build starts, buildFinished() is called when it is done */
+        err = clBuildProgram(_id, 0, NULL, options, buildFinished, _build_state);
+        
+        if (err != CL_SUCCESS)
+            buildFinished(_id, _build_state);
+        
+        return _build;
+    }
+    
+    std::shared_future<void> Program::compileFromSourceFileAsync (const char* file_path) {
+        std::ifstream file (file_path, std::ios::in | std::ios::binary);
         
-        if (file.is_open()) {
-            std::ifstream::pos_type size = file.tellg();
-            source = new char [(size_t)size];
-            file.seekg(0, std::ios::beg);
-            file.read(source, size);
-            file.close();
-        } else {
+        if (!file.is_open())
             throw Exception("Unable to open source file.");
-        }
         
-        compileFromSourceString(source);
+        std::string source ((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return compileFromSourceStringAsync(source.c_str());
+    }
+    
+    void Program::wait () {
+        /* Own copy, so several threads can wait at once */
+        std::shared_future<void> build = _build;
+        
+        if (!build.valid())
+            throw Exception("Program was not compiled.");
+        
+        build.get();
     }
 
     Kernel* Program::createKernel (const char* name) {
         cl_kernel kernel_id;
         cl_int err;
         
+        wait();
+        
         kernel_id = clCreateKernel(_id, name, &err);
         if (err != CL_SUCCESS)
             throw Exception("Could not create kernel. Wrong name?");
         
-        Kernel* kernel = new Kernel (_controller, kernel_id);
+        Kernel* kernel = new Kernel (_controller, *this, kernel_id);
+        
+        std::lock_guard<std::mutex> guard (_kernels_lock);
         _kernels.push_back(kernel);
         return kernel;
     }
+    
+    Kernel* Program::kernel (const char* name) {
+        {
+            std::lock_guard<std::mutex> guard (_kernels_lock);
+            std::map<std::string, Kernel*>::iterator it = _named_kernels.find(name);
+            
+            if (it != _named_kernels.end())
+                return it->second;
+        }
+        
+        /* Created without holding the lock, build may still be running */
+        Kernel* created = createKernel(name);
+        Kernel* existing;
+        
+        {
+            std::lock_guard<std::mutex> guard (_kernels_lock);
+            std::pair<std::map<std::string, Kernel*>::iterator, bool> inserted = _named_kernels.insert(std::make_pair(std::string(name), created));
+            
+            if (inserted.second)
+                return created;
+            
+            existing = inserted.first->second;
+        }
+        
+        /* Another thread was first */
+        release(created);
+        return existing;
+    }
+    
+    void Program::release (Kernel* kernel) {
+        {
+            std::lock_guard<std::mutex> guard (_kernels_lock);
+            std::vector<Kernel*>::iterator it = std::find(_kernels.begin(), _kernels.end(), kernel);
+            
+            if (it == _kernels.end())
+                throw Exception("Kernel was not created by this program.");
+            
+            _kernels.erase(it);
+            
+            for (std::map<std::string, Kernel*>::iterator named = _named_kernels.begin(); named != _named_kernels.end(); named++)
+                if (named->second == kernel) {
+                    _named_kernels.erase(named);
+                    break;
+                }
+        }
+        
+        delete kernel;
+    }
 }
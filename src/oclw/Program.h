@@ -10,6 +10,10 @@
 
 #include "OpenCL.h"
 #include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <future>
 
 namespace oclw {
     class Controller;
@@ -19,6 +23,15 @@ namespace oclw {
      *
      *  Can only be created by Controller.
      *  Provides methods for simple compilation and kernel creation.
+     *  
+     *  Compilation can run in the background while the host does something
+     *  else; kernels wait for it when they are first needed:
+     *  
+     *  \code
+     *  program->compileFromSourceFileAsync("program.cl");
+     *  // ... load input data ...
+     *  oclw::Kernel* kernel = program->kernel("blur");  // waits for the build
+     *  \endcode
      */
     class Program {
         friend class Controller;
@@ -28,6 +41,13 @@ namespace oclw {
         Controller& _controller;
         
         std::vector<Kernel*> _kernels;
+        std::map<std::string, Kernel*> _named_kernels;
+        std::mutex _kernels_lock;
+        
+        /* Build in progress (or finished), invalid if none was started */
+        struct Build;
+        Build* _build_state;
+        std::shared_future<void> _build;
         
     private:
         /* Private constructor enforces integrity stability.
@@ -40,6 +60,10 @@ namespace oclw {
          */
         void release ();
         
+        /* Called by OpenCL when build finishes.
+         */
+        static void CL_CALLBACK buildFinished (cl_program program, void* user_data);
+        
     public:
         /*! Compiles program from a source string.
          *  
@@ -53,9 +77,38 @@ namespace oclw {
          */
         void compileFromSourceFile (const char* file_path);
         
+        /*! Starts compiling program from a source string and returns immediately.
+         *  Source is copied, so it does not have to outlive the call.
+         *  
+         *  \return Future that becomes ready when the build is done. Its get()
+         *  throws Exception with the build log if compilation failed.
+         */
+        std::shared_future<void> compileFromSourceStringAsync (const char* source);
+        
+        /*! Reads source file and starts compiling it, see compileFromSourceStringAsync().
+         */
+        std::shared_future<void> compileFromSourceFileAsync (const char* file_path);
+        
+        /*! Blocks until the build is done. Throws Exception if it failed.
+         */
+        void wait ();
+        
         /*! Creates Kernel object defined in the source code.
+         *  Waits for the build if it is still running.
+         *  Can be called from several threads at once.
          */
         Kernel* createKernel (const char* name);
+        
+        /*! Returns kernel with given name, creating it on first call. Later calls
+         *  return the same object, so it must not be used by several threads
+         *  at once (use Kernel::clone() for that).
+         */
+        Kernel* kernel (const char* name);
+        
+        /*! Deletes kernel object created by this program.
+         *  Object must not be used afterwards.
+         */
+        void release (Kernel* kernel);
     };
 }
 
@@ -0,0 +1,338 @@
+//
+//  Trace.cpp
+//  OCLW
+//
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Trace.h"
+
+namespace oclw {
+
+    /* Span in the ring buffer. Device spans hold device clock timestamps,
+     * which are moved to host clock when trace is written.
+     */
+    struct TraceEvent {
+        char name[48];
+        const char* category;
+        unsigned int thread;        /* Host thread or command queue number */
+        bool device;
+        int64_t start, end;
+        int64_t queued;             /* Device only: when command was queued (device clock) */
+        int64_t enqueued;           /* Device only: host time right after enqueue returned */
+    };
+
+    /* Slot of the ring buffer. Busy flag is held by the thread writing or copying the
+     * event, so the event is never read while it is written.
+     */
+    struct TraceSlot {
+        std::atomic<bool> busy;
+        uint64_t ticket;            /* Number of the span in slot + 1, 0 if empty */
+        TraceEvent event;
+
+        TraceSlot () : busy (false), ticket (0) {}
+    };
+
+    /* Enqueued command whose timestamps are not known yet */
+    struct PendingEvent {
+        cl_event event;
+        std::string name;
+        unsigned int queue;
+        int64_t enqueued;
+    };
+
+    bool Trace::_enabled = false;
+
+    static TraceSlot* _slots = NULL;
+    static size_t _capacity = 0;
+    static std::atomic<uint64_t> _next (0);
+    static int64_t _start_time = 0;
+
+    static std::mutex _pending_lock;
+    static std::vector<PendingEvent> _pending;
+    static std::map<cl_command_queue, unsigned int> _queues;     /* Live queues and their numbers */
+    static unsigned int _queue_count = 0;
+
+    static std::atomic<unsigned int> _thread_count (0);
+    static thread_local unsigned int _thread = 0;
+
+    static const char* _output_path = NULL;
+
+    /* Number of pending commands after which completed ones are resolved */
+    static const size_t pending_limit = 1024;
+
+    static unsigned int threadNumber () {
+        if (_thread == 0)
+            _thread = ++_thread_count;
+
+        return _thread;
+    }
+
+    /* Copies event into the next slot. When the ring wraps onto a slot that is still
+     * being written or exported, the span is dropped instead of waiting.
+     */
+    static void record (const TraceEvent& event) {
+        uint64_t ticket = _next++;
+        TraceSlot& slot = _slots[ticket % _capacity];
+
+        if (slot.busy.exchange(true, std::memory_order_acquire))
+            return;
+
+        slot.event = event;
+        slot.ticket = ticket + 1;
+        slot.busy.store(false, std::memory_order_release);
+    }
+
+    static void writeAtExit () {
+        Trace::write(_output_path);
+    }
+
+    void Trace::enable (size_t capacity) {
+        if (_enabled)
+            return;
+
+        _capacity = std::max((size_t)1, capacity);
+        _slots = new TraceSlot[_capacity];
+        _start_time = now();
+        _enabled = true;
+    }
+
+    void Trace::enableFromEnvironment () {
+        const char* path = getenv("OCLW_TRACE");
+
+        if (path == NULL || path[0] == '\0' || _enabled)
+            return;
+
+        enable();
+        _output_path = path;
+        atexit(writeAtExit);
+    }
+
+    int64_t Trace::now () {
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+    }
+
+    void Trace::host (const char* name, const char* category, int64_t start, int64_t end) {
+        TraceEvent event;
+
+        strncpy(event.name, name, sizeof(event.name) - 1);
+        event.name[sizeof(event.name) - 1] = '\0';
+        event.category = category;
+        event.thread = threadNumber();
+        event.device = false;
+        event.start = start;
+        event.end = end;
+        event.queued = event.enqueued = 0;
+        record(event);
+    }
+
+    /* Reads timestamps of a completed command into the ring buffer and releases it.
+     */
+    static void resolve (const PendingEvent& pending) {
+        cl_ulong queued = 0, start = 0, end = 0;
+        cl_int err = 0;
+
+        err |= clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, NULL);
+        err |= clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        err |= clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        clReleaseEvent(pending.event);
+
+        /* Queue was created without profiling */
+        if (err != CL_SUCCESS)
+            return;
+
+        TraceEvent event;
+
+        strncpy(event.name, pending.name.c_str(), sizeof(event.name) - 1);
+        event.name[sizeof(event.name) - 1] = '\0';
+        event.category = "device";
+        event.thread = pending.queue;
+        event.device = true;
+        event.start = start;
+        event.end = end;
+        event.queued = queued;
+        event.enqueued = pending.enqueued;
+        record(event);
+    }
+
+    /* Resolves completed commands. Called with _pending_lock held.
+     */
+    static void resolveCompleted () {
+        size_t kept = 0;
+
+        for (size_t i = 0; i < _pending.size(); i++) {
+            cl_int status;
+
+            if (clGetEventInfo(_pending[i].event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL) == CL_SUCCESS &&
+                status <= CL_COMPLETE)
+                resolve(_pending[i]);
+            else
+                _pending[kept++] = _pending[i];
+        }
+
+        _pending.resize(kept);
+    }
+
+    void Trace::device (cl_event event, const char* name, cl_command_queue queue, bool owned) {
+        PendingEvent pending;
+        pending.event = event;
+        pending.name = name;
+        pending.enqueued = now();
+
+        if (!owned)
+            clRetainEvent(event);
+
+        std::lock_guard<std::mutex> guard (_pending_lock);
+
+        std::map<cl_command_queue, unsigned int>::iterator it = _queues.find(queue);
+        if (it == _queues.end())
+            it = _queues.insert(std::make_pair(queue, ++_queue_count)).first;
+        pending.queue = it->second;
+
+        _pending.push_back(pending);
+
+        if (_pending.size() > pending_limit)
+            resolveCompleted();
+    }
+
+    void Trace::releaseQueue (cl_command_queue queue) {
+        std::lock_guard<std::mutex> guard (_pending_lock);
+        _queues.erase(queue);
+    }
+
+    /* Escapes string for JSON output.
+     */
+    static std::string escape (const std::string& text) {
+        std::string escaped;
+
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == '"' || text[i] == '\\')
+                escaped += '\\';
+            if ((unsigned char)text[i] >= 0x20)
+                escaped += text[i];
+        }
+
+        return escaped;
+    }
+
+    /* Writes one complete ("X") event, times are in nanoseconds since trace start.
+     */
+    static void writeEvent (std::ostream& out, bool& first, const char* name, const char* category,
+                            int pid, unsigned int tid, int64_t start, int64_t end) {
+        out << (first ? "\n" : ",\n");
+        out << "  {\"name\": \"" << escape(name) << "\", \"cat\": \"" << category << "\", \"ph\": \"X\", \"pid\": " << pid
+            << ", \"tid\": " << tid << ", \"ts\": " << start / 1000.0 << ", \"dur\": " << std::max((int64_t)0, end - start) / 1000.0 << "}";
+        first = false;
+    }
+
+    static void writeName (std::ostream& out, bool& first, const char* what, int pid, unsigned int tid, const std::string& name) {
+        out << (first ? "\n" : ",\n");
+        out << "  {\"name\": \"" << what << "\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << tid
+            << ", \"args\": {\"name\": \"" << name << "\"}}";
+        first = false;
+    }
+
+    void Trace::write (std::ostream& out) {
+        unsigned int queue_count;
+
+        {
+            std::lock_guard<std::mutex> guard (_pending_lock);
+
+            for (size_t i = 0; i < _pending.size(); i++) {
+                clWaitForEvents(1, &_pending[i].event);
+                resolve(_pending[i]);
+            }
+            _pending.clear();
+            queue_count = _queue_count;
+        }
+
+        /* Snapshot of the ring buffer in recording order. Slots are held only while
+         * copied, so recording threads go on (or drop spans) meanwhile.
+         */
+        std::vector<std::pair<uint64_t, TraceEvent> > events;
+        events.reserve(_capacity);
+
+        for (size_t i = 0; i < _capacity; i++) {
+            TraceSlot& slot = _slots[i];
+
+            while (slot.busy.exchange(true, std::memory_order_acquire))
+                std::this_thread::yield();
+
+            if (slot.ticket != 0)
+                events.push_back(std::make_pair(slot.ticket, slot.event));
+
+            slot.busy.store(false, std::memory_order_release);
+        }
+
+        std::sort(events.begin(), events.end(),
+                  [] (const std::pair<uint64_t, TraceEvent>& a, const std::pair<uint64_t, TraceEvent>& b) {
+                      return a.first < b.first;
+                  });
+
+        /* Device clock is moved to host clock by the offset observed at enqueue. Host time
+         * taken right after enqueue is never earlier than the queued timestamp, so smallest
+         * difference is the closest estimate.
+         */
+        int64_t offset = 0;
+        bool offset_known = false;
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const TraceEvent& event = events[i].second;
+
+            if (event.device && (!offset_known || event.enqueued - event.queued < offset)) {
+                offset = event.enqueued - event.queued;
+                offset_known = true;
+            }
+        }
+
+        bool first = true;
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+        writeName(out, first, "process_name", 1, 0, "Host");
+        writeName(out, first, "process_name", 2, 0, "OpenCL device");
+
+        /* Queues are numbered from 1 and numbers are not reused, released queues keep their names */
+        for (unsigned int q = 1; q <= queue_count; q++) {
+            std::string queue = "Queue " + std::to_string(q);
+            writeName(out, first, "thread_name", 2, 2 * q, queue + " execution");
+            writeName(out, first, "thread_name", 2, 2 * q + 1, queue + " waiting");
+        }
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const TraceEvent& event = events[i].second;
+
+            if (event.device) {
+                int64_t base = offset - _start_time;
+                writeEvent(out, first, event.name, event.category, 2, 2 * event.thread + 1, event.queued + base, event.start + base);
+                writeEvent(out, first, event.name, event.category, 2, 2 * event.thread, event.start + base, event.end + base);
+            } else {
+                writeEvent(out, first, event.name, event.category, 1, event.thread, event.start - _start_time, event.end - _start_time);
+            }
+        }
+
+        out << "\n]}\n";
+    }
+
+    bool Trace::write (const char* path) {
+        std::ofstream file (path);
+
+        if (!file.is_open())
+            return false;
+
+        write(file);
+        return file.good();
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  Trace.h
+//  OCLW
+//
+
+#ifndef OCLW_Trace_h
+#define OCLW_Trace_h
+
+#include "OpenCL.h"
+#include <stdint.h>
+#include <ostream>
+
+namespace oclw {
+
+    /*! Timeline of host and device activity, exported in Chrome trace event
+     *  format (open with chrome://tracing or Perfetto).
+     *
+     *  Tracing is off unless enabled before the Controller is created, either
+     *  by calling enable() or by setting environment variable OCLW_TRACE to the
+     *  path of the output file, which is then written at exit. When enabled,
+     *  command queues are created with profiling, and OCLW records:
+     *
+     *  - host spans: argument setting, enqueues and waits (see TraceSpan),
+     *  - device spans: time each transfer and kernel waited in the queue and
+     *    time it executed, moved to the host clock.
+     *
+     *  Spans are kept in a fixed size ring buffer, so only the most recent
+     *  ones are exported. Recording a span takes no locks; a span whose slot is
+     *  still being written by a lapping thread or copied by write() is dropped.
+     */
+    class Trace {
+    private:
+        static bool _enabled;
+
+    public:
+        /*! Enables tracing. Must be called before Controller is created.
+         *
+         *  \param capacity Number of spans kept in the ring buffer.
+         */
+        static void enable (size_t capacity = 1 << 16);
+
+        /*! Enables tracing if OCLW_TRACE environment variable is set and
+         *  arranges for the trace to be written to that path at exit.
+         */
+        static void enableFromEnvironment ();
+
+        static bool enabled () {
+            return _enabled;
+        }
+
+        /*! Host clock in nanoseconds.
+         */
+        static int64_t now ();
+
+        /*! Records host span. Name is copied (and truncated if long), category
+         *  must be a string literal.
+         */
+        static void host (const char* name, const char* category, int64_t start, int64_t end);
+
+        /*! Records device span of an enqueued command. Timestamps are read once
+         *  command completes.
+         *
+         *  \param event Event of the command.
+         *  \param owned If true, trace takes over caller's reference to event,
+         *  otherwise it retains its own.
+         */
+        static void device (cl_event event, const char* name, cl_command_queue queue, bool owned);
+
+        /*! Forgets queue, so that a new queue created with the same handle gets its
+         *  own number. Called before queue is released.
+         */
+        static void releaseQueue (cl_command_queue queue);
+
+        /*! Waits for traced commands and writes all recorded spans as Chrome trace JSON.
+         */
+        static void write (std::ostream& out);
+
+        /*! Writes trace to a file. Returns false if file could not be written.
+         */
+        static bool write (const char* path);
+    };
+
+    /*! Records host span from construction to destruction:
+     *
+     *  \code
+     *  {
+     *      oclw::TraceSpan span ("decode", "app");
+     *      ...
+     *  }
+     *  \endcode
+     *
+     *  Does nothing if tracing is not enabled.
+     */
+    class TraceSpan {
+    private:
+        const char* _name;
+        const char* _category;
+        int64_t _start;
+
+    public:
+        TraceSpan (const char* name, const char* category = "oclw") : _name (name), _category (category) {
+            _start = Trace::enabled() ? Trace::now() : 0;
+        }
+
+        ~TraceSpan () {
+            if (Trace::enabled())
+                Trace::host(_name, _category, _start, Trace::now());
+        }
+    };
+}
+
+#endif